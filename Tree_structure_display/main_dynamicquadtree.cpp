@@ -15,6 +15,10 @@
  *
  * So, we modified the static quadtree to dynamic quadtree. You can compare the code to
  * see the difference for implmentation. 
+ *
+ * The tree can also be read by several threads while others insert and remove: the
+ * lists of objects are followed without lock, a writer only locks the node it changes
+ * and the removed objects are deleted through epochs, once no reader can be on them.
  */
 
 #include "src/App.h"
@@ -23,11 +27,17 @@
 #include <list>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <random>
 
 #define TEXT_COLOR color::red
 #define NUM_ENTITIES 1000000
 #define MAX_ENTITY_SIZE 100.0f
 #define MAX_DEPTH 8
+#define WRITER_OBJECTS 10000000 // objects of the writers benchmark
+#define READ_SECONDS 2.0 // of each run of the readers benchmark
+#define PREFETCH_MARGIN 0.05f // of the predicted view on each side, for the rounding of the camera
 
 
 struct Rect
@@ -76,27 +86,26 @@ template <class OBJ_T>
 class DynamicQuadTree
 {
     private:
-        // information about the container address and the iterator corresponding to 
-        // the current object.
-        template <class OBJ_NODE>
-        struct ObjectInfo
-        {
-            std::list<OBJ_NODE>* _pObjects;
-            typename std::list<OBJ_NODE>::iterator _objIt;
-        };
+        struct Item;
 
-        // now instead to hald the objects, the node hold the object address in the list.
-        template <class OBJ_NODE>
+        // now instead to hald the objects, the node hold the list of their items. The
+        // readers follow the list without lock while the writers of the node, under its
+        // lock, link the new items at the head and unlink the removed ones. The unlinked
+        // items are deleted once no reader can be on them.
         struct Node
         {
             Rect _area; // the area to be divided
             int _depth; // the depth of the tree, time to devide into quads
             std::array<Rect, 4> _vSubAreas{}; // areas of the quads
-            std::array<std::shared_ptr<Node<OBJ_NODE>>, 4> _vSubNodes{}; // children of the node
-            std::list<OBJ_NODE> _vObjects; // the objects belonging to the node
+            std::array<std::atomic<Node*>, 4> _vSubNodes; // children of the node, owned, set once by compare and swap
+            std::atomic<Item*> _head{nullptr}; // the objects belonging to the node
+            std::atomic<float> _maxSize{0.0f}; // size of the largest object of the subtree, not lowered by the removals
+            Node* _pParent; // nullptr for the root
 
+            std::mutex _mutex; // the writers of the list
+            std::vector<OBJ_T> _vAppended; // by insertConcurrent(), linked by flush()
 
-            Node(const Rect& r, int depth) : _area(r), _depth(depth)
+            Node(const Rect& r, int depth, Node* pParent) : _area(r), _depth(depth), _pParent(pParent)
             {
                 Vec2<float> childSize = _area.size / 2.0f;
 
@@ -107,103 +116,198 @@ class DynamicQuadTree
                     Rect(_area.pos + Vec2<float>{0.0f, childSize.y}, childSize), // bottom left
                     Rect(_area.pos + childSize, childSize) // bottom right
                 };
+                for (auto& child : _vSubNodes)
+                    child.store(nullptr, std::memory_order_relaxed);
+            }
+
+            ~Node()
+            {
+                for (Item* item = _head.load(std::memory_order_relaxed); item; )
+                {
+                    Item* next = item->_next.load(std::memory_order_relaxed);
+                    delete item;
+                    item = next;
+                }
+                for (auto& child : _vSubNodes)
+                    delete child.load(std::memory_order_relaxed);
             }
         };
 
-        // information about the actual object and its location in the quadtree.
-        struct ObjectListItem
+        // the object and its location in the quadtree: with the address of its node,
+        // the object is removed without searching the tree.
+        struct Item
         {
             OBJ_T _obj;
-            ObjectInfo<typename std::list<ObjectListItem>::iterator> _locationInTree;
+            Node* _pNode = nullptr;
+            std::atomic<Item*> _next{nullptr}; // kept when unlinked, a reader on the item goes on
+            Item* _prev = nullptr; // for the writers only
         };
-        using objType = typename std::list<ObjectListItem>::iterator;
-        // all objects will be stored in a container and we pass their location to the tree.
-        std::list<ObjectListItem> _vObjects;
 
-        std::shared_ptr<Node<objType>> _root;
+        std::atomic<Node*> _root{nullptr}; // owned
         Rect _area = {{0.0f, 0.0f}, {100.0f, 100.0f}};
+        std::atomic<size_t> _count{0}; // objects linked
+        std::atomic<size_t> _version{0}; // changed by each link and unlink, after it
+        mutable EpochReclaimer _epochs; // the removed items
 
-        
-        // recursive insert of an object
-        ObjectInfo<objType> insert(std::shared_ptr<Node<objType>>& node, const Rect& r, const objType& obj, int depth)
+        // largest side of the object
+        static float objectSize(const Rect& area)
         {
-            if (!node) node = std::make_shared<Node<objType>>(r, depth);
+            return std::max(area.size.x, area.size.y);
+        }
 
-            for (int i=0; i<4; i++)
+        // the node of the slot, created if missing. When several writers create it,
+        // the first compare and swap wins and the others delete theirs.
+        static Node* getOrCreate(std::atomic<Node*>& slot, const Rect& r, int depth, Node* pParent)
+        {
+            Node* node = slot.load(std::memory_order_acquire);
+            if (node) return node;
+
+            Node* created = new Node(r, depth, pParent);
+            if (slot.compare_exchange_strong(node, created, std::memory_order_acq_rel, std::memory_order_acquire))
+                return created;
+            delete created;
+            return node;
+        }
+
+        static void raiseMaxSize(std::atomic<float>& maxSize, float size)
+        {
+            float current = maxSize.load(std::memory_order_relaxed);
+            while (size > current && !maxSize.compare_exchange_weak(current, size, std::memory_order_relaxed)) {}
+        }
+
+        // the node of an object: the deepest one whose quad contains its area, the
+        // missing nodes are created and the sizes of the path raised to the object
+        Node* place(const Rect& area)
+        {
+            float size = objectSize(area);
+            Node* node = getOrCreate(_root, _area, 0, nullptr);
+            while (true)
             {
-                if (node->_vSubAreas[i].contains(obj->_obj.GetArea()))
-                {
-                    if (node->_depth + 1 < MAX_DEPTH)
-                    {
-                        if (!node->_vSubNodes[i])
-                        {
-                            node->_vSubNodes[i] = std::make_shared<Node<objType>>(node->_vSubAreas[i], node->_depth+1);
-                        }
-                        return insert(node->_vSubNodes[i], node->_vSubAreas[i], obj, node->_depth+1);
-                    }   
-                }
+                raiseMaxSize(node->_maxSize, size);
+                if (node->_depth + 1 >= MAX_DEPTH) break;
+
+                int i = 0;
+                while (i < 4 && !node->_vSubAreas[i].contains(area)) i++;
+                if (i == 4) break;
+                node = getOrCreate(node->_vSubNodes[i], node->_vSubAreas[i], node->_depth + 1, node);
             }
-            node->_vObjects.push_back(obj);
-            // reture the adress of the object in the tree
-            // and this information will be stored with the object in their container.
-            return {&(node->_vObjects), std::prev(node->_vObjects.end())};
+            return node;
         }
 
-        // recursive search of objects in an area
-        void search(const std::shared_ptr<Node<objType>>& node, const Rect& r, std::list<objType>& result) const
+        // the node an object of the area was placed in, nullptr if it was never created
+        Node* find(const Rect& area) const
         {
-            if (r.overlaps(node->_area))
+            Node* node = _root.load(std::memory_order_acquire);
+            while (node && node->_depth + 1 < MAX_DEPTH)
             {
-                for (const auto& obj : node->_vObjects)
-                { 
-                    if (r.overlaps(obj->_obj.GetArea()))
-                        result.push_back(obj);
-                }
-            
-                for (int i=0; i<4; i++)
-                {
-                    if (node->_vSubNodes[i])
-                    {
-                        if (r.contains(node->_vSubAreas[i]))
-                            items(node->_vSubNodes[i], result);
-                        else if (node->_vSubAreas[i].overlaps(r))
-                            search(node->_vSubNodes[i], r, result);
-                    }
-                }
+                int i = 0;
+                while (i < 4 && !node->_vSubAreas[i].contains(area)) i++;
+                if (i == 4) break;
+                node = node->_vSubNodes[i].load(std::memory_order_acquire);
             }
+            return node;
         }
 
-        // this is the remove function when traversing the whole tree
-        // not used in this implementation
-        bool remove(std::shared_ptr<Node<objType>>& node, const objType& obj)
+        // the deepest node containing the point, from a node near it: up to its first
+        // ancestor containing the point, then down. nullptr out of the tree.
+        const Node* locate(const Vec2<float>& p, const Node* node) const
         {
-            auto it = std::find_if(node->_vObjects.begin(), node->_vObjects.end(), 
-                            [&obj](const OBJ_T& item)
-                            {
-                                return item == obj;
-                            });
+            while (node && !node->_area.contains(p))
+                node = node->_pParent;
+            if (!node)
+            {
+                node = _root.load(std::memory_order_acquire);
+                if (!node || !node->_area.contains(p)) return nullptr;
+            }
 
-            if (it != node->_vObjects.end())
+            while (true)
             {
-                node->_vObjects.erase(it);
-                return true;
+                int i = 0;
+                while (i < 4 && !node->_vSubAreas[i].contains(p)) i++;
+                const Node* child = (i < 4) ? node->_vSubNodes[i].load(std::memory_order_acquire) : nullptr;
+                if (!child) return node;
+                node = child;
             }
+        }
+
+        // the objects of the node and of its ancestors overlapping it, in the order of the search
+        void gather(const Node* leaf, std::vector<Item*>& vItems) const
+        {
+            std::array<const Node*, MAX_DEPTH> vPath;
+            int n = 0;
+            for (const Node* node = leaf; node; node = node->_pParent)
+                vPath[n++] = node;
+
+            while (n-- > 0)
+            {
+                for (Item* item = vPath[n]->_head.load(std::memory_order_acquire); item; item = item->_next.load(std::memory_order_acquire))
+                {
+                    if (vPath[n] == leaf || leaf->_area.overlaps(item->_obj.GetArea()))
+                        vItems.push_back(item);
+                }
+            }
+        }
+
+        // at the head of the list of the node, under the lock of the node. The
+        // release publishes the object to the readers.
+        void link(Node* node, const OBJ_T& obj)
+        {
+            Item* item = new Item;
+            item->_obj = obj;
+            item->_pNode = node;
+            Item* head = node->_head.load(std::memory_order_relaxed);
+            item->_next.store(head, std::memory_order_relaxed);
+            if (head) head->_prev = item;
+            node->_head.store(item, std::memory_order_release);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _version.fetch_add(1, std::memory_order_release);
+        }
+
+        // out of the list of its node, under the lock of the node, then retired
+        void unlink(Item* item)
+        {
+            Item* next = item->_next.load(std::memory_order_relaxed);
+            if (item->_prev)
+                item->_prev->_next.store(next, std::memory_order_release);
             else
+                item->_pNode->_head.store(next, std::memory_order_release);
+            if (next) next->_prev = item->_prev;
+            _count.fetch_sub(1, std::memory_order_relaxed);
+            _version.fetch_add(1, std::memory_order_release);
+        }
+
+        // recursive search of objects in an area, of at least minSize
+        void search(const Node* node, const Rect& r, float minSize, std::list<Item*>& result, size_t& tested) const
+        {
+            if (!node || node->_maxSize.load(std::memory_order_relaxed) < minSize) return; // only smaller objects below
+
+            if (r.overlaps(node->_area))
             {
+                tested++;
+                for (Item* item = node->_head.load(std::memory_order_acquire); item; item = item->_next.load(std::memory_order_acquire))
+                { 
+                    Rect area = item->_obj.GetArea();
+                    tested++;
+                    if (r.overlaps(area) && objectSize(area) >= minSize)
+                        result.push_back(item);
+                }
+            
                 for (int i=0; i<4; i++)
                 {
-                    if (node->_vSubNodes[i])
+                    const Node* child = node->_vSubNodes[i].load(std::memory_order_acquire);
+                    if (child)
                     {
-                        if (remove(node->_vSubNodes[i], obj))
-                        return true;
+                        if (r.contains(node->_vSubAreas[i]))
+                            items(child, minSize, result, tested);
+                        else if (node->_vSubAreas[i].overlaps(r))
+                            search(child, r, minSize, result, tested);
                     }
                 }
             }
-            return false;
         }
 
         // recursive print of the tree structure
-        void print(const std::shared_ptr<Node<objType>>& node) const
+        void print(const Node* node) const
         {
             if (!node) return;
 
@@ -215,102 +319,220 @@ class DynamicQuadTree
 
             for (int i=0; i<4; i++)
             {
-                if (node->_vSubNodes[i])
-                {
-                    print(node->_vSubNodes[i]);
-                }
+                print(node->_vSubNodes[i].load(std::memory_order_acquire));
             }
         }
 
-        // recursive output all objects (parents and children) given a parent node
-        void items(const std::shared_ptr<Node<objType>>& node, std::list<objType>& result) const
+        // recursive output all objects (parents and children) of at least minSize given a parent node
+        void items(const Node* node, float minSize, std::list<Item*>& result, size_t& tested) const
         {
-            if (!node) return;
+            if (!node || node->_maxSize.load(std::memory_order_relaxed) < minSize) return;
 
-            for (const auto& obj : node->_vObjects)
+            tested++;
+            for (Item* item = node->_head.load(std::memory_order_acquire); item; item = item->_next.load(std::memory_order_acquire))
             { 
-                result.push_back(obj);
+                tested++;
+                if (objectSize(item->_obj.GetArea()) >= minSize)
+                    result.push_back(item);
             }
             for (const auto& child : node->_vSubNodes)
             {
-                items(child, result);
+                items(child.load(std::memory_order_acquire), minSize, result, tested);
             }
         }
 
-        // recursive count the number of objects (parents and children) given a parent node
-        size_t size(const std::shared_ptr<Node<objType>>& node) const
+        // the nodes with objects of insertConcurrent() to link
+        void pending(Node* node, std::vector<Node*>& vNodes) const
         {
-            size_t s = node->_vObjects.size();
-            for (int i=0; i<4; i++)
-            {
-                if (node->_vSubNodes[i])
-                    s += size(node->_vSubNodes[i]);
-            }
-            return s;
+            if (!node) return;
+            if (!node->_vAppended.empty())
+                vNodes.push_back(node);
+            for (const auto& child : node->_vSubNodes)
+                pending(child.load(std::memory_order_acquire), vNodes);
         }
 
     public:
-        DynamicQuadTree(): _root(nullptr) {};
+        // the address of an object in the tree, valid while the reader which found it holds its guard
+        using objType = Item*;
+
+        DynamicQuadTree() = default;
+        ~DynamicQuadTree() { delete _root.load(); };
+
+        DynamicQuadTree(const DynamicQuadTree&) = delete;
+        DynamicQuadTree& operator=(const DynamicQuadTree&) = delete;
 
         void SetArea(const Rect r)
         {
             _area = r;
         }
 
+        // The readers (search, items and the use of their results) hold a guard, they
+        // run while other threads insert and remove: the removed objects are deleted
+        // once no guard from before their removal is left. Without other thread, the
+        // guard is not needed.
+        EpochReclaimer::Guard read() const
+        {
+            return EpochReclaimer::Guard(_epochs);
+        }
+
+        // The writers lock the node of the object only, several of them insert and
+        // remove at once, and with the readers.
         void insert(const OBJ_T& obj)
         {
-            ObjectListItem item;
-            item._obj = obj;
-            _vObjects.push_back(item);
-            _vObjects.back()._locationInTree = insert(_root, _area, std::prev(_vObjects.end()), 0);  
+            TRACE_SCOPE("DynamicQuadTree::insert");
+            Node* node = place(obj.GetArea());
+            std::lock_guard<std::mutex> lock(node->_mutex);
+            link(node, obj);
         }
 
-        // old remove function
+        // The object is found by the path of its area, in the objects of
+        // insertConcurrent() not linked yet or in its node.
         bool remove(const OBJ_T& obj)
         {
-            return remove(_root, obj);
+            Node* node = find(obj.GetArea());
+            if (!node) return false;
+
+            std::lock_guard<std::mutex> lock(node->_mutex);
+            for (size_t i = 0; i < node->_vAppended.size(); i++)
+            {
+                if (node->_vAppended[i] == obj)
+                {
+                    node->_vAppended[i] = node->_vAppended.back();
+                    node->_vAppended.pop_back();
+                    return true;
+                }
+            }
+            for (Item* item = node->_head.load(std::memory_order_relaxed); item; item = item->_next.load(std::memory_order_relaxed))
+            {
+                if (item->_obj == obj)
+                {
+                    unlink(item);
+                    _epochs.retire(item);
+                    return true;
+                }
+            }
+            return false;
         }
         
         // This is the remove function when we store the object address in the tree.
         // Since we have direct access to the object in the tree, we can remove it 
-        // easily, whithout any recursive loops.
+        // easily, whithout any recursive loops. An object is removed once only.
         void remove(objType& obj)
         {
-            obj->_locationInTree._pObjects->erase(obj->_locationInTree._objIt);
-            _vObjects.erase(obj);
-    
+            TRACE_SCOPE("DynamicQuadTree::remove");
+            {
+                std::lock_guard<std::mutex> lock(obj->_pNode->_mutex);
+                unlink(obj);
+            }
+            _epochs.retire(obj);
+        }
+
+        // Insert of a bulk load from several threads at once: the object is appended
+        // to the buffer of its node and only linked, thus found by the searches, by
+        // flush(). Only the buffers of the node are locked, not the list the readers follow.
+        void insertConcurrent(const OBJ_T& obj)
+        {
+            Node* node = place(obj.GetArea());
+            std::lock_guard<std::mutex> lock(node->_mutex);
+            node->_vAppended.push_back(obj);
+        }
+
+        // link the objects of insertConcurrent() once its writers are done, the nodes
+        // in parallel on the pool. The readers and the other writers may go on.
+        void flush(ThreadPool& pool)
+        {
+            TRACE_SCOPE("DynamicQuadTree::flush");
+            std::vector<Node*> vNodes;
+            pending(_root.load(std::memory_order_acquire), vNodes);
+
+            pool.parallelFor(vNodes.size(), [&](size_t k)
+            {
+                Node* node = vNodes[k];
+                std::lock_guard<std::mutex> lock(node->_mutex);
+                for (const auto& obj : node->_vAppended)
+                    link(node, obj);
+                std::vector<OBJ_T>().swap(node->_vAppended); // the memory of a bulk load is released
+            });
+        }
+
+        // the last point location, the next one starts from it
+        struct Finger
+        {
+            const Node* _pNode = nullptr; // the deepest node containing the last point
+            size_t _version = 0; // of the tree when the candidates were gathered
+            std::vector<Item*> _vCandidates; // the objects of the node and its ancestors overlapping it
+        };
+
+        // The object on top at the point (the last one in the order of the search), of at
+        // least minSize, nullptr if none. OBJ_T::contains(point) tests the object itself.
+        // Only the nodes containing the point hold objects under it: the deepest one is
+        // located from the finger, then the objects of its path overlapping it are gathered,
+        // most of them in the ancestors (the objects across their quads). The mouse mostly
+        // stays in the same node between two frames, the finger keeps them until it leaves
+        // the node or the tree changes. In a read guard, as the search.
+        objType pick(const Vec2<float>& p, Finger& finger, float minSize = 0.0f) const
+        {
+            TRACE_SCOPE("DynamicQuadTree::pick");
+            auto guard = read();
+            const Node* leaf = locate(p, finger._pNode);
+            if (!leaf) return nullptr;
+
+            // an object unlinked before the version read is not gathered, one unlinked
+            // after changes the version and the next pick gathers again
+            size_t version = _version.load(std::memory_order_acquire);
+            if (leaf != finger._pNode || version != finger._version)
+            {
+                finger._pNode = leaf;
+                finger._version = version;
+                finger._vCandidates.clear();
+                gather(leaf, finger._vCandidates);
+            }
+
+            for (auto it = finger._vCandidates.rbegin(); it != finger._vCandidates.rend(); ++it)
+            {
+                if ((*it)->_obj.contains(p) && objectSize((*it)->_obj.GetArea()) >= minSize)
+                    return *it;
+            }
+            return nullptr;
         }
 
-        // Now the search returns the adresses of the objects in their holding list.
-        std::list<objType> search(const Rect& r)
+        // Now the search returns the adresses of the objects in the tree,
+        // without those smaller than minSize. The nodes visited and the objects
+        // tested are added to pTested, per call since the readers run at once.
+        std::list<objType> search(const Rect& r, float minSize = 0.0f, size_t* pTested = nullptr) const
         {
+            TRACE_SCOPE("DynamicQuadTree::search");
             std::list<objType> result;
-            search(_root, r, result);
+            size_t tested = 0;
+            auto guard = read(); // the results need the guard of the caller
+            search(_root.load(std::memory_order_acquire), r, minSize, result, tested);
+            if (pTested) *pTested += tested;
             return result;
         }
 
-        // std::list<OBJ_T> search(const Rect& r)
-        // {
-        //     std::list<OBJ_T> result;
-        //     search(_root, r, result);
-        //     return result;
-        // }
-
         std::list<objType> items() const
         {
-            std::list<OBJ_T> results;
-            items(_root, results);
+            std::list<objType> results;
+            size_t tested = 0;
+            auto guard = read();
+            items(_root.load(std::memory_order_acquire), 0.0f, results, tested);
             return results;
         }
 
         size_t size() const
         {
-            return size(_root);
+            return _count.load(std::memory_order_relaxed);
+        }
+
+        // removed objects not deleted yet, a reader holding its guard keeps them
+        size_t retired() const
+        {
+            return _epochs.getPending();
         }
 
         void print() const
         {
-            print(_root);
+            print(_root.load(std::memory_order_acquire));
         }
 };
 
@@ -319,7 +541,7 @@ class TreeApp: public SDLCommon
 {
     public:
         TreeApp() {_appName = "Trees For Display";};
-        ~TreeApp() = default;
+        ~TreeApp() { _prefetch.sync(); }; // the query of the worker writes the members
 
     protected:
         struct CObject
@@ -331,15 +553,36 @@ class TreeApp: public SDLCommon
             SDL_Color color = {0, 0, 0, 255};
             Rect GetArea() const {return {pos-r, {r * 2.0f, r * 2.0f}};};
             bool operator==(const CObject& other) const {return pos == other.pos && size == other.size;};
+            bool contains(const Vec2<float>& p) const {return (p.x - pos.x) * (p.x - pos.x) + (p.y - pos.y) * (p.y - pos.y) <= r * r;};
         };
 
         float areaLength = MAX_ENTITY_SIZE * 1000.0f;
         float _cursorSize = 50.0f;
         bool _bErase= false;
+        DynamicQuadTree<CObject>::Finger _finger; // of the mouse
+        bool _bHover = false;
+        CObject _hovered; // the object under the mouse, highlighted
         Rect searchRect;
         std::vector<CObject> vObjects;
         DynamicQuadTree<CObject> _dynamicQuadTree;
         bool _bUseQuadTree = true; // option to use QuadTree
+        std::vector<const CObject*> _vVisible; // objects found by the linear search, reused each frame
+        int _phaseQuery;
+        int _phaseRaster;
+
+        // the query of the next view runs on a worker during the frame
+        bool _bPrefetch = true;
+        TaskGroup _prefetch{getThreadPool(), true}; // background, not run by the syncs of the frame
+        bool _bPrefetching = false; // a query is spawned, not synced yet
+        Rect _lastView; // of the previous frame
+        Rect _prefetchView; // predicted, with the margin
+        float _prefetchMinSize = 0.0f;
+        size_t _treeVersion = 0; // changed by the eraser
+        size_t _prefetchVersion = 0; // of the tree when the query was spawned
+        std::vector<CObject> _vPrefetched; // found by the query of the worker
+        std::vector<CObject> _vFound; // drawn by the frame
+        size_t _prefetchQueries = 0;
+        size_t _prefetchHits = 0;
 
         bool onUserInit() override 
         {
@@ -363,6 +606,11 @@ class TreeApp: public SDLCommon
                 _dynamicQuadTree.insert(obj); // insert objects in quadtree
             }
 
+            _vVisible.reserve(vObjects.size());
+            _lastView = Rect(getCameraViewport());
+            _phaseQuery = _profiler.addPhase("query");
+            _phaseRaster = _profiler.addPhase("raster");
+
             // Show some  information
             std::cout << "objs created: " << vObjects.size() << std::endl;
             std::cout << "objs in QuadTree: " << _dynamicQuadTree.size() << std::endl;
@@ -370,15 +618,184 @@ class TreeApp: public SDLCommon
             return true;
         };
 
+        // insert WRITER_OBJECTS objects in a new tree with 1 to N writer threads through
+        // the concurrent path, against the single threaded insert
+        void benchmarkWriters(std::ostream& os)
+        {
+            std::vector<CObject> vNew(WRITER_OBJECTS);
+            srand(1);
+            for (auto& obj : vNew)
+            {
+                obj.pos = {(float)rand() / RAND_MAX * areaLength, (float)rand() / RAND_MAX * areaLength};
+                obj.r = (float)rand() / RAND_MAX * MAX_ENTITY_SIZE;
+                obj.size = {2.0f * obj.r, 2.0f * obj.r};
+            }
+
+            int maxWriters = std::max(1u, std::thread::hardware_concurrency());
+            os << "WRITERS inserting " << vNew.size() << " objects (" << maxWriters << " cores)" << std::endl;
+            {
+                DynamicQuadTree<CObject> tree;
+                tree.SetArea({{0.0f, 0.0f}, {areaLength, areaLength}});
+                auto ticStart = std::chrono::steady_clock::now();
+                for (const auto& obj : vNew)
+                    tree.insert(obj);
+                std::chrono::duration<double> s = std::chrono::steady_clock::now() - ticStart;
+                os << "  insert: " << s.count() * 1000.0 << " ms, " << vNew.size() / s.count() / 1e6 << " M objects/s" << std::endl;
+            }
+
+            for (int writers = 1; writers <= maxWriters; writers = (writers == maxWriters) ? writers + 1 : std::min(2 * writers, maxWriters))
+            {
+                DynamicQuadTree<CObject> tree;
+                tree.SetArea({{0.0f, 0.0f}, {areaLength, areaLength}});
+                auto ticStart = std::chrono::steady_clock::now();
+                std::vector<std::thread> vThreads;
+                for (int w = 0; w < writers; w++)
+                {
+                    vThreads.emplace_back([&tree, &vNew, w, writers]()
+                    {
+                        size_t end = vNew.size() * (w + 1) / writers;
+                        for (size_t i = vNew.size() * w / writers; i < end; i++)
+                            tree.insertConcurrent(vNew[i]);
+                    });
+                }
+                for (auto& thread : vThreads)
+                    thread.join();
+                std::chrono::duration<double> s = std::chrono::steady_clock::now() - ticStart;
+
+                ticStart = std::chrono::steady_clock::now();
+                tree.flush(getThreadPool());
+                std::chrono::duration<double, std::milli> flush = std::chrono::steady_clock::now() - ticStart;
+                os << "  " << writers << " writers: " << s.count() * 1000.0 << " ms, " << vNew.size() / s.count() / 1e6 
+                   << " M objects/s, flush " << flush.count() << " ms, " << tree.size() << " in the tree" << std::endl;
+            }
+        }
+
+        // threads searching random views of a new tree for READ_SECONDS, alone then while a
+        // writer removes and inserts objects again: the readers never wait for it
+        void benchmarkReaders(std::ostream& os)
+        {
+            const float viewLength = areaLength / 10.0f;
+            DynamicQuadTree<CObject> tree;
+            tree.SetArea({{0.0f, 0.0f}, {areaLength, areaLength}});
+            for (const auto& obj : vObjects)
+                tree.insert(obj);
+
+            int readers = std::max(1u, std::thread::hardware_concurrency() - 1);
+            os << "READERS of " << tree.size() << " objects, views of " << viewLength << " (" << readers << " readers)" << std::endl;
+            for (bool bWriter : {false, true})
+            {
+                std::atomic<bool> bRunning{true};
+                std::atomic<size_t> queries{0}, found{0};
+                size_t updates = 0;
+                std::vector<std::thread> vThreads;
+                for (int t = 0; t < readers; t++)
+                {
+                    vThreads.emplace_back([&, t]()
+                    {
+                        std::mt19937 rng(t);
+                        std::uniform_real_distribution<float> pos(0.0f, areaLength - viewLength);
+                        size_t n = 0, count = 0;
+                        while (bRunning.load(std::memory_order_relaxed))
+                        {
+                            auto guard = tree.read();
+                            count += tree.search({{pos(rng), pos(rng)}, {viewLength, viewLength}}).size();
+                            n++;
+                        }
+                        queries += n;
+                        found += count;
+                    });
+                }
+
+                auto ticStart = std::chrono::steady_clock::now();
+                std::chrono::duration<double> s{0.0};
+                std::mt19937 rng(1);
+                while (s.count() < READ_SECONDS)
+                {
+                    if (bWriter)
+                    {
+                        // the objects move: out of the tree and in again
+                        const CObject& obj = vObjects[rng() % vObjects.size()];
+                        if (tree.remove(obj))
+                            tree.insert(obj);
+                        updates++;
+                    }
+                    else
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    s = std::chrono::steady_clock::now() - ticStart;
+                }
+                bRunning = false;
+                for (auto& thread : vThreads)
+                    thread.join();
+
+                os << "  " << (bWriter ? "with a writer: " : "alone: ") << queries / s.count() << " queries/s, " 
+                   << (queries ? found / queries : 0) << " objects per query";
+                if (bWriter)
+                    os << ", " << updates / s.count() << " updates/s, " << tree.retired() << " removed objects not deleted yet";
+                os << std::endl;
+            }
+        }
+
+        // the objects of the view from the prefetched query, false if the prediction
+        // missed: the view is out of the predicted one or the tree changed since
+        bool consumePrefetch(const Rect& view, float minSize)
+        {
+            if (!_bPrefetching) return false;
+            _prefetch.sync();
+            _bPrefetching = false;
+            _prefetchQueries++;
+            if (_prefetchVersion != _treeVersion || !_prefetchView.contains(view) || minSize < _prefetchMinSize)
+                return false;
+
+            _prefetchHits++;
+            for (const auto& obj : _vPrefetched)
+            {
+                if (view.overlaps(obj.GetArea()) && 2.0f * obj.r >= minSize)
+                    _vFound.push_back(obj);
+            }
+            return true;
+        }
+
+        // Spawn the query of the view of the next frame, extrapolated from this one and
+        // the previous one: a pan steps by a constant offset and a zoom scales the view
+        // by a constant ratio about a fixed point, both give next = (1 + k) * view - k * last
+        // with k the ratio of the sizes. The tree is read on the worker while the frame goes on.
+        void prefetchNext(const Rect& view, float minSize)
+        {
+            if (_bPrefetch && getThreadPool().getWorkerCount() > 0 && _lastView.size.x > 0.0f)
+            {
+                float k = view.size.x / _lastView.size.x;
+                Vec2<float> size = {view.size.x * k, view.size.y * k};
+                Vec2<float> margin = {size.x * PREFETCH_MARGIN, size.y * PREFETCH_MARGIN};
+                _prefetchView = {{(1.0f + k) * view.pos.x - k * _lastView.pos.x - margin.x,
+                                  (1.0f + k) * view.pos.y - k * _lastView.pos.y - margin.y},
+                                 {size.x + 2.0f * margin.x, size.y + 2.0f * margin.y}};
+                _prefetchMinSize = minSize * std::min(k, 1.0f) * (1.0f - PREFETCH_MARGIN); // smaller when zooming in
+                _prefetchVersion = _treeVersion;
+                _vPrefetched.clear();
+                _prefetch.spawn([this]()
+                {
+                    auto guard = _dynamicQuadTree.read();
+                    for (const auto& item : _dynamicQuadTree.search(_prefetchView, _prefetchMinSize))
+                        _vPrefetched.push_back(item->_obj);
+                });
+                _bPrefetching = true;
+            }
+            _lastView = view;
+        }
+
         void onUserUpdate(float frameTime) override 
         {
             // handle keyboard inputs
-            while (SDL_PollEvent(&_event) != 0)
+            while (pollEvent(_event))
             {
                 if (_event.type == SDL_QUIT)
                 {
                     _atomIsRunning = false;
                 }
+                else if (_event.type == SDL_WINDOWEVENT)
+                {
+                    markDirty(); // exposed or resized
+                }
                 else if (_event.type == SDL_MOUSEWHEEL)
                 {
                     if (_event.wheel.y > 0)
@@ -396,7 +813,18 @@ class TreeApp: public SDLCommon
                 {
                     switch (_event.key.keysym.sym)
                     {
-                        case SDLK_TAB: _bUseQuadTree = !_bUseQuadTree; break; // add quadtree option
+                        case SDLK_F1: toggleProfilerOverlay(); break;
+                        case SDLK_F2: TRACE_EXPORT("trace.json"); break;
+                        case SDLK_F3: togglePerfCounters(); break;
+                        case SDLK_F4: benchmarkRaster(std::cout); break;
+                        case SDLK_F5: toggleBatch(); break;
+                        case SDLK_F7: toggleRedrawOnDemand(); break;
+                        case SDLK_F6: toggleTileCache(); break;
+                        case SDLK_F8: cycleSmallObjects(); break;
+                        case SDLK_F9: benchmarkWriters(std::cout); break;
+                        case SDLK_F10: benchmarkReaders(std::cout); break;
+                        case SDLK_F11: _bPrefetch = !_bPrefetch; break;
+                        case SDLK_TAB: _bUseQuadTree = !_bUseQuadTree; markDirty(); break; // add quadtree option
                         case SDLK_UP: Pan(0, -10); break;
                         case SDLK_DOWN: Pan(0, 10); break;
                         case SDLK_LEFT: Pan(-10, 0); break;
@@ -412,7 +840,7 @@ class TreeApp: public SDLCommon
                 {
                     switch (_event.key.keysym.sym)
                     {
-                        case SDLK_LSHIFT: if (_bErase) _bErase = false; break;
+                        case SDLK_LSHIFT: if (_bErase) _bErase = false; markDirty(); break;
                     }
                 }
             }
@@ -420,49 +848,126 @@ class TreeApp: public SDLCommon
             Vec2<float> searchArea = {_cursorSize, _cursorSize};
             searchRect = {posMouse - searchArea/2.0f, searchArea};
 
+            {
+                auto guard = _dynamicQuadTree.read();
+                auto item = _dynamicQuadTree.pick(posMouse, _finger, getMinWorldSize());
+                if ((item != nullptr) != _bHover || (item && !(item->_obj == _hovered)))
+                    markDirty(); // the highlight moves
+                _bHover = (item != nullptr);
+                if (item) _hovered = item->_obj;
+            }
+
             if (_bErase)
             {
+                markDirty(); // the eraser follows the mouse and the tree changes
                 // std::cout << "erase" << std::endl;
+                auto guard = _dynamicQuadTree.read(); // the objects found are removed after the search
                 auto r = _dynamicQuadTree.search(searchRect);
                 int n = 0;
+                Rect changed = searchRect; // grown to the removed objects
                 for (auto& i : r)
                 {
+                    Rect area = i->_obj.GetArea();
+                    float x1 = std::max(changed.pos.x + changed.size.x, area.pos.x + area.size.x);
+                    float y1 = std::max(changed.pos.y + changed.size.y, area.pos.y + area.size.y);
+                    changed.pos = {std::min(changed.pos.x, area.pos.x), std::min(changed.pos.y, area.pos.y)};
+                    changed.size = {x1 - changed.pos.x, y1 - changed.pos.y};
                     _dynamicQuadTree.remove(i);
                 }
+                if (!r.empty())
+                {
+                    _treeVersion++; // a prefetched query may hold the removed objects
+                    // only the cached tiles under the removed objects are rendered again
+                    InvalidateCache({(int)floorf(changed.pos.x), (int)floorf(changed.pos.y),
+                                     (int)ceilf(changed.size.x) + 1, (int)ceilf(changed.size.y) + 1});
+                }
             }  
         }
 
+        // the cached tiles are rendered from the quadtree
+        void onUserRenderTile(const SDL_Rect& world) override
+        {
+            auto guard = _dynamicQuadTree.read();
+            for (const auto& item : _dynamicQuadTree.search(Rect(world), getMinWorldSize()))
+                DrawFilledCircle({(int)item->_obj.pos.x, (int)item->_obj.pos.y}, item->_obj.r, item->_obj.color);
+        }
+
         void onUserRender() override
         {
             Rect screen = {getCameraViewport()};
             size_t count = 0;
 
-            if (_bUseQuadTree)
+            if (isTileCacheEnabled())
+            {
+                // the viewport is mostly blits of cached tiles, the erased areas are invalidated
+                DrawCachedInfo(_phaseRaster, TEXT_COLOR);
+            }
+            else if (_bUseQuadTree)
             {
                 auto ticStart = std::chrono::system_clock::now();
                 Rect r = Rect(_cameraViewport);
-                for (const auto& item : _dynamicQuadTree.search(r))
+                bool bHit = false;
+                {
+                    ScopedTimer t(_profiler, _phaseQuery);
+                    float minSize = getMinWorldSize();
+                    _vFound.clear();
+                    size_t tested = 0;
+                    bHit = consumePrefetch(r, minSize);
+                    if (bHit)
+                        tested = _vPrefetched.size(); // synced, filtered to the view
+                    else
+                    {
+                        auto guard = _dynamicQuadTree.read();
+                        for (const auto& item : _dynamicQuadTree.search(r, minSize, &tested))
+                            _vFound.push_back(item->_obj);
+                    }
+                    prefetchNext(r, minSize);
+                    _profiler.addItems(_phaseQuery, tested); // the work of the query, not its results
+                }
                 {
-                    DrawFilledCircle({(int)item->_obj.pos.x, (int)item->_obj.pos.y}, item->_obj.r, item->_obj.color);
-                    count++;
+                    ScopedTimer t(_profiler, _phaseRaster);
+                    BeginBatch();
+                    for (const auto& obj : _vFound)
+                    {
+                        DrawFilledCircle({(int)obj.pos.x, (int)obj.pos.y}, obj.r, obj.color);
+                        count++;
+                    }
+                    FlushBatch();
+                    _profiler.addItems(_phaseRaster, count);
                 }
                 std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
                 std::string info = "QUADTREE: "  + 
                                 std::to_string(count) + "/" + 
                                 std::to_string(vObjects.size()) + " Time: " + 
-                                std::to_string(ticDuration.count()) + " s";
+                                std::to_string(ticDuration.count()) + " s" +
+                                (_bPrefetch ? std::string(bHit ? " PREFETCH hit " : " PREFETCH miss ") + 
+                                              std::to_string(_prefetchHits) + "/" + std::to_string(_prefetchQueries) : "");
                 DrawText(info, {10, 10}, TEXT_COLOR);
             }
             else
             {
                 auto ticStart = std::chrono::system_clock::now();
-                for (const auto& obj : vObjects)
                 {
-                    if (screen.overlaps(obj.GetArea()))
+                    ScopedTimer t(_profiler, _phaseQuery);
+                    _vVisible.clear();
+                    float minSize = getMinWorldSize();
+                    for (const auto& obj : vObjects)
                     {
-                        DrawFilledCircle({(int)obj.pos.x, (int)obj.pos.y}, obj.r, obj.color);
+                        if (screen.overlaps(obj.GetArea()) && 2.0f * obj.r >= minSize)
+                            _vVisible.push_back(&obj);
+                    }
+                    _profiler.addItems(_phaseQuery, vObjects.size()); // all the objects are tested
+                }
+                {
+                    ScopedTimer t(_profiler, _phaseRaster);
+                    BeginBatch();
+                    for (const auto* obj : _vVisible)
+                    {
+                        DrawFilledCircle({(int)obj->pos.x, (int)obj->pos.y}, obj->r, obj->color);
                         count++;
                     }
+                    FlushBatch();
+                    _profiler.addItems(_phaseRaster, count);
                 }
                 std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
                 std::string info = "LINEAR: "  + 
@@ -472,15 +977,45 @@ class TreeApp: public SDLCommon
                 DrawText(info, {10, 10}, TEXT_COLOR);
             }  
             if (_bErase)
+            {
+                setDrawBlendMode(SDL_BLENDMODE_BLEND); // translucent eraser
                 DrawFilledRect({(int)searchRect.pos.x, (int)searchRect.pos.y}, searchRect.size.x, searchRect.size.y, {255, 255, 255, 100});
+                setDrawBlendMode(SDL_BLENDMODE_NONE);
+            }
+            if (_bHover)
+                DrawCircle({(int)_hovered.pos.x, (int)_hovered.pos.y}, (int)_hovered.r + 1, color::white);
         }
 };
 
 
-int main()
+int main(int argc, char* argv[])
 {
     TreeApp quadtree;
-    if (quadtree.init(800, 800, 20000, 20000))
+
+    // --zero-alloc: fail if a frame allocates after the warm-up frames
+    // --on-demand: only redraw when the view or the data changes
+    // --fps N: cap the frame rate
+    // --threaded: update on a fixed timestep thread, render on the main thread
+    // --small skip|splat: objects below one pixel skipped or splatted
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--zero-alloc")
+            quadtree.setZeroAllocationCheck(60);
+        else if (arg == "--on-demand")
+            quadtree.setRedrawOnDemand(true);
+        else if (arg == "--fps" && i + 1 < argc)
+            quadtree.setFrameCap(atoi(argv[++i]));
+        else if (arg == "--threaded")
+            quadtree.setThreadedUpdate(true);
+        else if (arg == "--small" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+            quadtree.setSmallObjects(policy == "splat" ? SmallObjects::SPLAT : SmallObjects::SKIP);
+        }
+    }
+
+    if (quadtree.init(800, 800, 20000, 20000, RenderMode::SCREEN))
         quadtree.execute();
-    return 0;
+    return quadtree.hasFailed() ? 1 : 0;
 }
\ No newline at end of file
@@ -80,6 +80,9 @@ class TreeApp: public SDLCommon
 
         float areaLength = MAX_ENTITY_SIZE * 100.0f;
         std::vector<Object> vObjects;
+        std::vector<const Object*> _vVisible; // objects found in the viewport, reused each frame
+        int _phaseQuery;
+        int _phaseRaster;
 
     protected:
         bool onUserInit() override 
@@ -101,6 +104,10 @@ class TreeApp: public SDLCommon
                 vObjects.push_back(obj);
             }
 
+            _vVisible.reserve(vObjects.size());
+            _phaseQuery = _profiler.addPhase("query");
+            _phaseRaster = _profiler.addPhase("raster");
+
             // Show some  information
             std::cout << "#objs created: " << vObjects.size() << std::endl;
             
@@ -110,12 +117,16 @@ class TreeApp: public SDLCommon
         void onUserUpdate(float frameTime) override 
         {
             // handle keyboard inputs
-            while (SDL_PollEvent(&_event) != 0)
+            while (pollEvent(_event))
             {
                 if (_event.type == SDL_QUIT)
                 {
                     _atomIsRunning = false;
                 }
+                else if (_event.type == SDL_WINDOWEVENT)
+                {
+                    markDirty(); // exposed or resized
+                }
                 else if (_event.type == SDL_MOUSEWHEEL)
                 {
                     if (_event.wheel.y > 0)
@@ -131,6 +142,13 @@ class TreeApp: public SDLCommon
                 {
                     switch (_event.key.keysym.sym)
                     {
+                        case SDLK_F1: toggleProfilerOverlay(); break;
+                        case SDLK_F2: TRACE_EXPORT("trace.json"); break;
+                        case SDLK_F3: togglePerfCounters(); break;
+                        case SDLK_F4: benchmarkRaster(std::cout); break;
+                        case SDLK_F5: toggleBatch(); break;
+                        case SDLK_F7: toggleRedrawOnDemand(); break;
+                        case SDLK_F8: cycleSmallObjects(); break;
                         case SDLK_UP: Pan(0, -10); break;
                         case SDLK_DOWN: Pan(0, 10); break;
                         case SDLK_LEFT: Pan(-10, 0); break;
@@ -146,13 +164,26 @@ class TreeApp: public SDLCommon
             size_t count = 0;
 
             auto ticStart = std::chrono::system_clock::now();
-            for (const auto& obj : vObjects)
             {
-                if (screen.overlaps(obj.GetArea()))
+                ScopedTimer t(_profiler, _phaseQuery);
+                _vVisible.clear();
+                for (const auto& obj : vObjects)
+                {
+                    if (screen.overlaps(obj.GetArea()))
+                        _vVisible.push_back(&obj);
+                }
+                _profiler.addItems(_phaseQuery, vObjects.size()); // all the objects are tested
+            }
+            {
+                ScopedTimer t(_profiler, _phaseRaster);
+                BeginBatch();
+                for (const auto* obj : _vVisible)
                 {
-                    DrawFilledCircle({(int)obj.pos.x, (int)obj.pos.y}, obj.r, obj.color);
+                    DrawFilledCircle({(int)obj->pos.x, (int)obj->pos.y}, obj->r, obj->color);
                     count++;
                 }
+                FlushBatch();
+                _profiler.addItems(_phaseRaster, count);
             }
             std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
             std::string info = "LINEAR: " + 
@@ -163,10 +194,34 @@ class TreeApp: public SDLCommon
         }
 };
 
-int main()
+int main(int argc, char* argv[])
 {
     TreeApp treeapp;
+
+    // --zero-alloc: fail if a frame allocates after the warm-up frames
+    // --on-demand: only redraw when the view or the data changes
+    // --fps N: cap the frame rate
+    // --threaded: update on a fixed timestep thread, render on the main thread
+    // --small skip|splat: objects below one pixel skipped or splatted
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--zero-alloc")
+            treeapp.setZeroAllocationCheck(60);
+        else if (arg == "--on-demand")
+            treeapp.setRedrawOnDemand(true);
+        else if (arg == "--fps" && i + 1 < argc)
+            treeapp.setFrameCap(atoi(argv[++i]));
+        else if (arg == "--threaded")
+            treeapp.setThreadedUpdate(true);
+        else if (arg == "--small" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+            treeapp.setSmallObjects(policy == "splat" ? SmallObjects::SPLAT : SmallObjects::SKIP);
+        }
+    }
+
     if (treeapp.init(800, 800, 10000, 10000))
         treeapp.execute();
-    return 0;
+    return treeapp.hasFailed() ? 1 : 0;
 }
\ No newline at end of file
@@ -14,6 +14,8 @@
 #define NUM_ENTITIES 1000000
 #define MAX_ENTITY_SIZE 100.0f
 #define MAX_DEPTH 8
+#define SPRITE_SIZE 16 // pixels on the screen
+#define NUM_SPRITES 8
 
 
 struct Rect
@@ -69,6 +71,7 @@ class StaticQuadTree
             std::array<Rect, 4> _vSubAreas{}; // areas of the quads
             std::array<std::shared_ptr<Node>, 4> _vSubNodes{}; // children of the node
             std::vector<OBJ_T> _vObjects; // the objects belonging to the node
+            float _maxSize = 0.0f; // size of the largest object of the subtree
 
             Node(const Rect& r, int depth) : _area(r), _depth(depth)
             {
@@ -86,11 +89,19 @@ class StaticQuadTree
 
         std::shared_ptr<Node> _root;
         Rect _area = {{0.0f, 0.0f}, {100.0f, 100.0f}};
+        mutable size_t _tested = 0; // nodes visited and objects tested by the searches
+
+        // largest side of the object
+        static float objectSize(const Rect& area)
+        {
+            return std::max(area.size.x, area.size.y);
+        }
         
         // recursive insert of an object
         void insert(std::shared_ptr<Node>& node, const Rect& r, const OBJ_T& obj, int depth)
         {
             if (!node) node = std::make_shared<Node>(r, depth);
+            node->_maxSize = std::max(node->_maxSize, objectSize(obj.GetArea()));
 
             for (int i=0; i<4; i++)
             {
@@ -110,14 +121,18 @@ class StaticQuadTree
             node->_vObjects.push_back(obj);
         }
 
-        // recursive search of objects in an area
-        void search(const std::shared_ptr<Node>& node, const Rect& r, std::list<OBJ_T>& result) const
+        // recursive search of objects in an area, of at least minSize
+        void search(const std::shared_ptr<Node>& node, const Rect& r, float minSize, std::list<OBJ_T>& result) const
         {
+            if (node->_maxSize < minSize) return; // only smaller objects below
+
             if (r.overlaps(node->_area))
             {
+                _tested += 1 + node->_vObjects.size();
                 for (const auto& obj : node->_vObjects)
                 { 
-                    if (r.overlaps(obj.GetArea()))
+                    Rect area = obj.GetArea();
+                    if (r.overlaps(area) && objectSize(area) >= minSize)
                         result.push_back(obj);
                 }
             
@@ -126,9 +141,9 @@ class StaticQuadTree
                     if (node->_vSubNodes[i])
                     {
                         if (r.contains(node->_vSubAreas[i]))
-                            items(node->_vSubNodes[i], result);
+                            items(node->_vSubNodes[i], minSize, result);
                         else if (node->_vSubAreas[i].overlaps(r))
-                            search(node->_vSubNodes[i], r, result);
+                            search(node->_vSubNodes[i], r, minSize, result);
                     }
                 }
             }
@@ -154,18 +169,20 @@ class StaticQuadTree
             }
         }
 
-        // recursive output all objects (parents and children) given a parent node
-        void items(const std::shared_ptr<Node>& node, std::list<OBJ_T>& result) const
+        // recursive output all objects (parents and children) of at least minSize given a parent node
+        void items(const std::shared_ptr<Node>& node, float minSize, std::list<OBJ_T>& result) const
         {
-            if (!node) return;
+            if (!node || node->_maxSize < minSize) return;
 
+            _tested += 1 + node->_vObjects.size();
             for (const auto& obj : node->_vObjects)
             { 
-                result.push_back(obj);
+                if (objectSize(obj.GetArea()) >= minSize)
+                    result.push_back(obj);
             }
             for (const auto& child : node->_vSubNodes)
             {
-                items(child, result);
+                items(child, minSize, result);
             }
         }
 
@@ -191,20 +208,23 @@ class StaticQuadTree
 
         void insert(const OBJ_T& obj)
         {
+            TRACE_SCOPE("StaticQuadTree::insert");
             insert(_root, _area, obj, 0);
         }
 
-        std::list<OBJ_T> search(const Rect& r)
+        // the objects overlapping r, without those smaller than minSize
+        std::list<OBJ_T> search(const Rect& r, float minSize = 0.0f)
         {
+            TRACE_SCOPE("StaticQuadTree::search");
             std::list<OBJ_T> result;
-            search(_root, r, result);
+            search(_root, r, minSize, result);
             return result;
         }
 
         std::list<OBJ_T> items() const
         {
             std::list<OBJ_T> results;
-            items(_root, results);
+            items(_root, 0.0f, results);
             return results;
         }
 
@@ -213,6 +233,12 @@ class StaticQuadTree
             return size(_root);
         }
 
+        // the work of the searches so far, nodes and objects
+        size_t tested() const
+        {
+            return _tested;
+        }
+
         void print() const
         {
             print(_root);
@@ -234,6 +260,7 @@ class TreeApp: public SDLCommon
             Vec2<float> size = {0.0f, 0.0f};
             float r = 1.0f;
             SDL_Color color = {0, 0, 0, 255};
+            int sprite = 0; // index in the sprite atlas
             Rect GetArea() const {return {pos-r, {r * 2.0f, r * 2.0f}};};
         };
 
@@ -241,9 +268,49 @@ class TreeApp: public SDLCommon
         std::vector<CObject> vObjects;
         StaticQuadTree<CObject> _staticQuadTree;
         bool _bUseQuadTree = true; // option to use QuadTree
+        bool _bDrawSprites = false; // objects drawn as sprites of the atlas
+        std::vector<const CObject*> _vVisible; // objects found by the linear search, reused each frame
+        int _phaseQuery;
+        int _phaseRaster;
+
+        // shaded balls with transparent corners and opaque squares, in a row
+        void buildSprites()
+        {
+            SpriteAtlas& atlas = getSpriteAtlas();
+            if (!atlas.create(NUM_SPRITES * SPRITE_SIZE, SPRITE_SIZE)) return;
+
+            Uint32* pixels = atlas.getPixels();
+            int pitch = atlas.getPitch();
+            const SDL_Color colors[NUM_SPRITES] = {color::red, color::green, color::blue, color::yellow,
+                                                   color::cyan, color::fuchsia, color::orange, color::silver};
+            for (int i = 0; i < NUM_SPRITES; i++)
+            {
+                bool bSquare = i >= NUM_SPRITES - 2;
+                float c = (SPRITE_SIZE - 1) / 2.0f;
+                for (int y = 0; y < SPRITE_SIZE; y++)
+                {
+                    for (int x = 0; x < SPRITE_SIZE; x++)
+                    {
+                        float d = sqrtf((x - c) * (x - c) + (y - c) * (y - c)) / (c + 0.5f);
+                        Uint32& p = pixels[y * pitch + i * SPRITE_SIZE + x];
+                        if (!bSquare && d > 1.0f)
+                        {
+                            p = 0; // transparent
+                            continue;
+                        }
+                        float shade = bSquare ? 1.0f : 1.0f - 0.6f * d;
+                        p = convertColorUint({(Uint8)(colors[i].r * shade), (Uint8)(colors[i].g * shade),
+                                              (Uint8)(colors[i].b * shade), 255});
+                    }
+                }
+            }
+            atlas.addGrid(SPRITE_SIZE, SPRITE_SIZE);
+        }
 
         bool onUserInit() override 
         {
+            buildSprites();
+
             // initialize the tree
             _staticQuadTree.SetArea({{0.0f, 0.0f}, {areaLength, areaLength}}); 
             
@@ -260,10 +327,15 @@ class TreeApp: public SDLCommon
                 obj.size.x = 2.0f * obj.r;
                 obj.size.y = 2.0f * obj.r;
                 obj.color = {(Uint8)(rand()%256), (Uint8)(rand()%256), (Uint8)(rand()%256)};
+                obj.sprite = rand() % NUM_SPRITES;
                 vObjects.push_back(obj);
                 _staticQuadTree.insert(obj); // insert objects in quadtree
             }
 
+            _vVisible.reserve(vObjects.size());
+            _phaseQuery = _profiler.addPhase("query");
+            _phaseRaster = _profiler.addPhase("raster");
+
             // Show some  information
             std::cout << "objs created: " << vObjects.size() << std::endl;
             std::cout << "objs in QuadTree: " << _staticQuadTree.size() << std::endl;
@@ -278,12 +350,16 @@ class TreeApp: public SDLCommon
         void onUserUpdate(float frameTime) override 
         {
             // handle keyboard inputs
-            while (SDL_PollEvent(&_event) != 0)
+            while (pollEvent(_event))
             {
                 if (_event.type == SDL_QUIT)
                 {
                     _atomIsRunning = false;
                 }
+                else if (_event.type == SDL_WINDOWEVENT)
+                {
+                    markDirty(); // exposed or resized
+                }
                 else if (_event.type == SDL_MOUSEWHEEL)
                 {
                     if (_event.wheel.y > 0)
@@ -299,7 +375,16 @@ class TreeApp: public SDLCommon
                 {
                     switch (_event.key.keysym.sym)
                     {
-                        case SDLK_TAB: _bUseQuadTree = !_bUseQuadTree; break; // add quadtree option
+                        case SDLK_F1: toggleProfilerOverlay(); break;
+                        case SDLK_F2: TRACE_EXPORT("trace.json"); break;
+                        case SDLK_F3: togglePerfCounters(); break;
+                        case SDLK_F4: benchmarkRaster(std::cout); break;
+                        case SDLK_F5: toggleBatch(); break;
+                        case SDLK_F7: toggleRedrawOnDemand(); break;
+                        case SDLK_F6: toggleTileCache(); break;
+                        case SDLK_F8: cycleSmallObjects(); break;
+                        case SDLK_TAB: _bUseQuadTree = !_bUseQuadTree; markDirty(); break; // add quadtree option
+                        case SDLK_s: _bDrawSprites = !_bDrawSprites; markDirty(); break;
                         case SDLK_UP: Pan(0, -10); break;
                         case SDLK_DOWN: Pan(0, 10); break;
                         case SDLK_LEFT: Pan(-10, 0); break;
@@ -309,19 +394,86 @@ class TreeApp: public SDLCommon
             }  
         }
 
+        // the cached tiles are rendered from the quadtree
+        void onUserRenderTile(const SDL_Rect& world) override
+        {
+            for (const auto& item : _staticQuadTree.search(Rect(world), getMinWorldSize()))
+                DrawFilledCircle({(int)item.pos.x, (int)item.pos.y}, item.r, item.color);
+        }
+
+        // the sprites keep their size on the screen, the query is grown by half a sprite
+        void drawSprites()
+        {
+            auto ticStart = std::chrono::system_clock::now();
+            float half = SPRITE_SIZE / 2.0f / _zoomScale;
+            Rect r = Rect(_cameraViewport);
+            r.pos = r.pos - half;
+            r.size = {r.size.x + 2.0f * half, r.size.y + 2.0f * half};
+
+            std::list<CObject> found;
+            {
+                ScopedTimer t(_profiler, _phaseQuery);
+                size_t tested = _staticQuadTree.tested();
+                found = _staticQuadTree.search(r);
+                _profiler.addItems(_phaseQuery, _staticQuadTree.tested() - tested);
+            }
+            size_t count = 0;
+            {
+                ScopedTimer t(_profiler, _phaseRaster);
+                for (const auto& item : found)
+                {
+                    DrawSprite(item.sprite, {(int)item.pos.x, (int)item.pos.y});
+                    count++;
+                }
+                _profiler.addItems(_phaseRaster, count);
+            }
+            std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
+            std::string info = "SPRITES: "  + 
+                            std::to_string(count) + "/" + 
+                            std::to_string(vObjects.size()) + " Time: " + 
+                            std::to_string(ticDuration.count()) + " s";
+            DrawText(info, {10, 10}, TEXT_COLOR);
+        }
+
         void onUserRender() override
         {
             Rect screen = {getCameraViewport()};
             size_t count = 0;
 
+            if (_bDrawSprites)
+            {
+                drawSprites();
+                return;
+            }
+
+            if (isTileCacheEnabled())
+            {
+                // the scene is static, the viewport is mostly blits of cached tiles
+                DrawCachedInfo(_phaseRaster, TEXT_COLOR);
+                return;
+            }
+
             if (_bUseQuadTree)
             {
                 auto ticStart = std::chrono::system_clock::now();
                 Rect r = Rect(_cameraViewport);
-                for (const auto& item : _staticQuadTree.search(r))
+                std::list<CObject> found;
                 {
-                    DrawFilledCircle({(int)item.pos.x, (int)item.pos.y}, item.r, item.color);
-                    count++;
+                    ScopedTimer t(_profiler, _phaseQuery);
+                    size_t tested = _staticQuadTree.tested();
+                    found = _staticQuadTree.search(r, getMinWorldSize());
+                    _profiler.addItems(_phaseQuery, _staticQuadTree.tested() - tested); // the work of the query, not its results
+                }
+                {
+                    ScopedTimer t(_profiler, _phaseRaster);
+                    BeginBatch();
+                    for (const auto& item : found)
+                    {
+                        DrawFilledCircle({(int)item.pos.x, (int)item.pos.y}, item.r, item.color);
+                        count++;
+                    }
+                    FlushBatch();
+                    _profiler.addItems(_phaseRaster, count);
                 }
                 std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
                 std::string info = "QUADTREE: "  + 
@@ -333,13 +485,27 @@ class TreeApp: public SDLCommon
             else
             {
                 auto ticStart = std::chrono::system_clock::now();
-                for (const auto& obj : vObjects)
                 {
-                    if (screen.overlaps(obj.GetArea()))
+                    ScopedTimer t(_profiler, _phaseQuery);
+                    _vVisible.clear();
+                    float minSize = getMinWorldSize();
+                    for (const auto& obj : vObjects)
                     {
-                        DrawFilledCircle({(int)obj.pos.x, (int)obj.pos.y}, obj.r, obj.color);
+                        if (screen.overlaps(obj.GetArea()) && 2.0f * obj.r >= minSize)
+                            _vVisible.push_back(&obj);
+                    }
+                    _profiler.addItems(_phaseQuery, vObjects.size()); // all the objects are tested
+                }
+                {
+                    ScopedTimer t(_profiler, _phaseRaster);
+                    BeginBatch();
+                    for (const auto* obj : _vVisible)
+                    {
+                        DrawFilledCircle({(int)obj->pos.x, (int)obj->pos.y}, obj->r, obj->color);
                         count++;
                     }
+                    FlushBatch();
+                    _profiler.addItems(_phaseRaster, count);
                 }
                 std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
                 std::string info = "LINEAR: "  + 
@@ -352,10 +518,34 @@ class TreeApp: public SDLCommon
 };
 
 
-int main()
+int main(int argc, char* argv[])
 {
     TreeApp quadtree;
-    if (quadtree.init(800, 800, 20000, 20000))
+
+    // --zero-alloc: fail if a frame allocates after the warm-up frames
+    // --on-demand: only redraw when the view or the data changes
+    // --fps N: cap the frame rate
+    // --threaded: update on a fixed timestep thread, render on the main thread
+    // --small skip|splat: objects below one pixel skipped or splatted
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--zero-alloc")
+            quadtree.setZeroAllocationCheck(60);
+        else if (arg == "--on-demand")
+            quadtree.setRedrawOnDemand(true);
+        else if (arg == "--fps" && i + 1 < argc)
+            quadtree.setFrameCap(atoi(argv[++i]));
+        else if (arg == "--threaded")
+            quadtree.setThreadedUpdate(true);
+        else if (arg == "--small" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+            quadtree.setSmallObjects(policy == "splat" ? SmallObjects::SPLAT : SmallObjects::SKIP);
+        }
+    }
+
+    if (quadtree.init(800, 800, 20000, 20000, RenderMode::SCREEN))
         quadtree.execute();
-    return 0;
+    return quadtree.hasFailed() ? 1 : 0;
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include "src/App.h"
 #include <chrono>
 #include <array>
+#include <cfloat>
 #include <list>
 #include <memory>
 
@@ -29,7 +30,7 @@ struct Rect
 
     Vec2<float> size{0.0f, 0.0f};
     Vec2<float> pos{0.0f, 0.0f};
-    std::vector<int> color {0, 0, 0};
+    std::vector<int> color; // left empty unless given, so building a Rect does not allocate
 
     constexpr bool contains(const Vec2<float>& point) const
     {
@@ -82,8 +83,114 @@ struct Rect
 };
 
 
+// statistics about the structure and the memory of an index
+struct IndexStats
+{
+    size_t entries = 0; // stored objects, an object can be stored several times (grid)
+    size_t nodes = 0;
+    size_t nodeBytes = 0; // the nodes themselves
+    size_t payloadBytes = 0; // the stored objects
+    size_t overheadBytes = 0; // shared_ptr control blocks, heap of the Rects, unused capacity
+    std::vector<size_t> depthHistogram; // number of nodes at each depth
+    std::vector<size_t> objectsHistogram; // number of nodes with 0, 1, 2-3, 4-7, ... objects
+    size_t queries = 0;
+    double avgNodesVisited = 0.0; // per query since the start
+    size_t candidates = 0; // objects tested exactly, when the index has a coarse test first
+    size_t found = 0;
+
+    // estimations of the hidden allocations
+    static constexpr size_t SHARED_PTR_BLOCK = 2 * sizeof(void*); // make_shared control block
+
+    size_t totalBytes() const { return nodeBytes + payloadBytes + overheadBytes; };
+
+    void addNode(int depth, size_t objects)
+    {
+        nodes++;
+        entries += objects;
+
+        if (depthHistogram.size() <= (size_t)depth)
+            depthHistogram.resize(depth + 1, 0);
+        depthHistogram[depth]++;
+
+        size_t bucket = 0;
+        while (objects >> bucket) bucket++;
+        if (objectsHistogram.size() <= bucket)
+            objectsHistogram.resize(bucket + 1, 0);
+        objectsHistogram[bucket]++;
+    }
+
+    void print(std::ostream& os, const std::string& name) const
+    {
+        auto mb = [](size_t b) { return std::to_string(b / (1024.0 * 1024.0)).substr(0, 6) + " MB"; };
+
+        os << name << ": " << entries << " entries, " << nodes << " nodes, "
+           << depthHistogram.size() << " levels" << std::endl;
+        os << "  memory: " << mb(totalBytes()) << " (nodes " << mb(nodeBytes)
+           << ", payload " << mb(payloadBytes) << ", overhead " << mb(overheadBytes) << ")" << std::endl;
+
+        os << "  nodes per depth:";
+        for (size_t d = 0; d < depthHistogram.size(); d++)
+            os << " " << d << ":" << depthHistogram[d];
+        os << std::endl;
+
+        os << "  objects per node:";
+        for (size_t b = 0; b < objectsHistogram.size(); b++)
+        {
+            if (!objectsHistogram[b]) continue;
+            if (b < 2)
+                os << " " << b << ":" << objectsHistogram[b];
+            else
+                os << " " << (1 << (b - 1)) << "-" << (1 << b) - 1 << ":" << objectsHistogram[b];
+        }
+        os << std::endl;
+
+        os << "  nodes visited per query: " << avgNodesVisited << " (" << queries << " queries)" << std::endl;
+        if (candidates)
+            os << "  exact tests: " << candidates << " for " << found << " found ("
+               << (100.0 * found / candidates) << "% kept)" << std::endl;
+    }
+};
+
+
+// the interface of the indices of this demo, resolved at compile time (CRTP).
+// An index implements insert, clear, for_each_in, remove, size, stats and
+// tested (the nodes visited and the objects tested by its queries so far),
+// the helpers below are built on them without any virtual call.
+template <class INDEX, class OBJ_T>
+class SpatialIndex
+{
+    public:
+        // bulk build from all the objects, overridden by the indices with a
+        // better layout when all the objects are known
+        void build(const std::vector<OBJ_T>& objects)
+        {
+            index().clear();
+            for (const auto& obj : objects)
+                index().insert(obj);
+        }
+
+        // the objects overlapping r, without those smaller than minSize
+        std::list<OBJ_T> search(const Rect& r, float minSize = 0.0f)
+        {
+            std::list<OBJ_T> result;
+            index().for_each_in(r, minSize, [&result](const OBJ_T& obj) { result.push_back(obj); });
+            return result;
+        }
+
+        size_t count(const Rect& r, float minSize = 0.0f)
+        {
+            size_t n = 0;
+            index().for_each_in(r, minSize, [&n](const OBJ_T&) { n++; });
+            return n;
+        }
+
+    protected:
+        INDEX& index() { return static_cast<INDEX&>(*this); }
+};
+
+
 template <class OBJ_T>
-class StaticQuadTree
+class StaticQuadTree : public SpatialIndex<StaticQuadTree<OBJ_T>, OBJ_T>
 {
     private:
         struct Node
@@ -93,10 +200,21 @@ class StaticQuadTree
             std::array<Rect, 4> _vSubAreas{}; // areas of the quads
             std::array<std::shared_ptr<Node>, 4> _vSubNodes{}; // children of the node
             std::vector<OBJ_T> _vObjects; // the objects belonging to the node
+            float _maxSize = 0.0f; // size of the largest object of the subtree
+
+            // bounds of the objects on 16 bits relative to _area, the min rounded down and
+            // the max up. They are scanned first, only their candidates are tested exactly.
+            struct QBounds
+            {
+                uint16_t x0, y0, x1, y1;
+            };
+            std::vector<QBounds> _vBounds; // same order as _vObjects
+            Vec2<float> _quantScale; // quantised units per world unit
 
             Node(const Rect& r, int depth) : _area(r), _depth(depth)
             {
                 Vec2<float> childSize = _area.size / 2.0f;
+                _quantScale = {65535.0f / std::max(_area.size.x, 1.0f), 65535.0f / std::max(_area.size.y, 1.0f)};
 
                 _vSubAreas =
                 {
@@ -106,15 +224,43 @@ class StaticQuadTree
                     Rect(_area.pos + childSize, childSize) // bottom right
                 };
             }
+
+            // clamped to the node, so a box outside still overlaps the clamped query conservatively
+            inline uint16_t quantise(float v, float origin, float scale, bool bRoundUp) const
+            {
+                float q = (v - origin) * scale;
+                q = bRoundUp ? ceilf(q) : floorf(q);
+                return (uint16_t)std::min(65535.0f, std::max(0.0f, q));
+            }
+
+            QBounds quantise(const Rect& r) const
+            {
+                return {quantise(r.pos.x, _area.pos.x, _quantScale.x, false),
+                        quantise(r.pos.y, _area.pos.y, _quantScale.y, false),
+                        quantise(r.pos.x + r.size.x, _area.pos.x, _quantScale.x, true),
+                        quantise(r.pos.y + r.size.y, _area.pos.y, _quantScale.y, true)};
+            }
         };
 
         std::shared_ptr<Node> _root;
         Rect _area = {{0.0f, 0.0f}, {100.0f, 100.0f}};
+        mutable size_t _queries = 0; // for the statistics
+        mutable size_t _nodesVisited = 0;
+        mutable size_t _objectsTested = 0; // quantised bounds or objects read by the queries
+        mutable size_t _candidates = 0; // objects passing the quantised test
+        mutable size_t _found = 0; // and the exact one
+
+        // largest side of the object
+        static float objectSize(const Rect& area)
+        {
+            return std::max(area.size.x, area.size.y);
+        }
         
         // recursive insert of an object
         void insert(std::shared_ptr<Node>& node, const Rect& r, const OBJ_T& obj, int depth)
         {
             if (!node) node = std::make_shared<Node>(r, depth);
+            node->_maxSize = std::max(node->_maxSize, objectSize(obj.GetArea()));
 
             for (int i=0; i<4; i++)
             {
@@ -132,11 +278,17 @@ class StaticQuadTree
                 }
             }
             node->_vObjects.push_back(obj);
+            node->_vBounds.push_back(node->quantise(obj.GetArea()));
         }
 
-        // recursive search of objects in an area
-        void search(const std::shared_ptr<Node>& node, const Rect& r, std::list<OBJ_T>& result) const
+        // recursive search of objects in an area, of at least minSize
+        template <class FUNC>
+        void search(const std::shared_ptr<Node>& node, const Rect& r, float minSize, FUNC& f) const
         {
+            if (!node) return;
+            _nodesVisited++;
+            if (node->_maxSize < minSize) return; // only smaller objects below
+
             // if (!node) return;
 
             // if (r.contains(node->_area))
@@ -146,10 +298,23 @@ class StaticQuadTree
             // }
             if (r.overlaps(node->_area))
             {
-                for (const auto& obj : node->_vObjects)
+                // the 8 bytes bounds, 8 objects per cache line, then the exact test of the candidates
+                typename Node::QBounds q = node->quantise(r);
+                _objectsTested += node->_vBounds.size();
+                for (size_t i = 0; i < node->_vBounds.size(); i++)
                 { 
-                    if (r.overlaps(obj.GetArea()))
-                        result.push_back(obj);
+                    const typename Node::QBounds& b = node->_vBounds[i];
+                    if (b.x0 > q.x1 || b.x1 < q.x0 || b.y0 > q.y1 || b.y1 < q.y0)
+                        continue;
+
+                    _candidates++;
+                    const OBJ_T& obj = node->_vObjects[i];
+                    Rect area = obj.GetArea();
+                    if (r.overlaps(area) && objectSize(area) >= minSize)
+                    {
+                        f(obj);
+                        _found++;
+                    }
                 }
             
                 for (int i=0; i<4; i++)
@@ -157,9 +322,9 @@ class StaticQuadTree
                     if (node->_vSubNodes[i])
                     {
                         if (r.contains(node->_vSubAreas[i]))
-                            items(node->_vSubNodes[i], result);
+                            items(node->_vSubNodes[i], minSize, f);
                         else if (node->_vSubAreas[i].overlaps(r))
-                            search(node->_vSubNodes[i], r, result);
+                            search(node->_vSubNodes[i], r, minSize, f);
                     }
                 }
             }
@@ -185,24 +350,79 @@ class StaticQuadTree
             }
         }
 
-        // recursive output all objects (parents and children) given a parent node
-        void items(const std::shared_ptr<Node>& node, std::list<OBJ_T>& result) const
+        // recursive output all objects (parents and children) of at least minSize given a parent node
+        template <class FUNC>
+        void items(const std::shared_ptr<Node>& node, float minSize, FUNC& f) const
         {
             if (!node) return;
+            _nodesVisited++;
+            if (node->_maxSize < minSize) return;
 
+            // the bounds are only read back when the small objects are filtered
+            _objectsTested += node->_vObjects.size();
             for (const auto& obj : node->_vObjects)
             { 
-                result.push_back(obj);
+                if (minSize <= 0.0f || objectSize(obj.GetArea()) >= minSize)
+                    f(obj);
             }
             for (const auto& child : node->_vSubNodes)
             {
-                items(child, result);
+                items(child, minSize, f);
             }
         }
 
+        // as items(), the subtrees above spawnDepth are tasks of the group
+        template <class FUNC>
+        void parallelItems(TaskGroup& group, const Node* node, float minSize, int spawnDepth, FUNC& f) const
+        {
+            if (!node || node->_maxSize < minSize) return;
+
+            for (const auto& obj : node->_vObjects)
+            { 
+                if (minSize <= 0.0f || objectSize(obj.GetArea()) >= minSize)
+                    f(obj);
+            }
+            for (const auto& child : node->_vSubNodes)
+            {
+                const Node* pChild = child.get();
+                if (!pChild) continue;
+                if (node->_depth < spawnDepth)
+                    group.spawn([this, &group, pChild, minSize, spawnDepth, &f]() { parallelItems(group, pChild, minSize, spawnDepth, f); });
+                else
+                    parallelItems(group, pChild, minSize, spawnDepth, f);
+            }
+        }
+
+        // the node holding the object, found by the path of the insert
+        bool remove(const std::shared_ptr<Node>& node, const OBJ_T& obj, const Rect& area)
+        {
+            if (!node) return false;
+
+            for (int i=0; i<4; i++)
+            {
+                if (node->_vSubNodes[i] && node->_vSubAreas[i].contains(area))
+                    return remove(node->_vSubNodes[i], obj, area);
+            }
+
+            for (size_t i = 0; i < node->_vObjects.size(); i++)
+            {
+                if (node->_vObjects[i] == obj)
+                {
+                    // the order of the objects in a node does not matter, _maxSize stays an upper bound
+                    node->_vObjects[i] = node->_vObjects.back();
+                    node->_vObjects.pop_back();
+                    node->_vBounds[i] = node->_vBounds.back();
+                    node->_vBounds.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        }
+
         // recursive count the number of objects (parents and children) given a parent node
         size_t size(const std::shared_ptr<Node>& node) const
         {
+            if (!node) return 0;
             size_t s = node->_vObjects.size();
             for (int i=0; i<4; i++)
             {
@@ -212,7 +432,26 @@ class StaticQuadTree
             return s;
         }
 
+        // recursive collect of the statistics of a node and its children
+        void stats(const std::shared_ptr<Node>& node, IndexStats& s) const
+        {
+            if (!node) return;
+
+            s.addNode(node->_depth, node->_vObjects.size());
+            s.nodeBytes += sizeof(Node);
+            s.payloadBytes += node->_vObjects.size() * sizeof(OBJ_T) +
+                              node->_vBounds.size() * sizeof(typename Node::QBounds);
+            s.overheadBytes += IndexStats::SHARED_PTR_BLOCK +
+                               (node->_vObjects.capacity() - node->_vObjects.size()) * sizeof(OBJ_T) +
+                               (node->_vBounds.capacity() - node->_vBounds.size()) * sizeof(typename Node::QBounds);
+
+            for (const auto& child : node->_vSubNodes)
+                stats(child, s);
+        }
+
     public:
+        using SpatialIndex<StaticQuadTree<OBJ_T>, OBJ_T>::search;
+
         StaticQuadTree(): _root(nullptr) {};
 
         void SetArea(const Rect r)
@@ -222,20 +461,47 @@ class StaticQuadTree
 
         void insert(const OBJ_T& obj)
         {
+            TRACE_SCOPE("StaticQuadTree::insert");
             insert(_root, _area, obj, 0);
         }
 
-        std::list<OBJ_T> search(const Rect& r)
+        void clear()
         {
-            std::list<OBJ_T> result;
-            search(_root, r, result);
-            return result;
+            _root = nullptr;
+        }
+
+        // f(obj) for the objects overlapping r, without those smaller than minSize
+        template <class FUNC>
+        void for_each_in(const Rect& r, float minSize, FUNC&& f)
+        {
+            TRACE_SCOPE("StaticQuadTree::search");
+            _queries++;
+            search(_root, r, minSize, f);
+        }
+
+        // the object must still have the bounds it was inserted with
+        bool remove(const OBJ_T& obj)
+        {
+            return remove(_root, obj, obj.GetArea());
+        }
+
+        // f(obj) for all the objects of at least minSize, the subtrees of the nodes
+        // above spawnDepth fanned out on the pool: f is called from several threads.
+        // Not counted in the statistics.
+        template <class FUNC>
+        void parallel_items(ThreadPool& pool, float minSize, int spawnDepth, FUNC&& f) const
+        {
+            TRACE_SCOPE("StaticQuadTree::parallel_items");
+            TaskGroup group(pool);
+            parallelItems(group, _root.get(), minSize, spawnDepth, f);
+            group.sync();
         }
 
         std::list<OBJ_T> items() const
         {
             std::list<OBJ_T> results;
-            items(_root, results);
+            auto add = [&results](const OBJ_T& obj) { results.push_back(obj); };
+            items(_root, 0.0f, add);
             return results;
         }
 
@@ -248,11 +514,27 @@ class StaticQuadTree
         {
             print(_root);
         }
+
+        IndexStats stats() const
+        {
+            IndexStats s;
+            stats(_root, s);
+            s.queries = _queries;
+            s.avgNodesVisited = _queries ? (double)_nodesVisited / _queries : 0.0;
+            s.candidates = _candidates;
+            s.found = _found;
+            return s;
+        }
+
+        size_t tested() const
+        {
+            return _nodesVisited + _objectsTested;
+        }
 };
 
 
 template <class OBJ_T>
-class GridTree
+class GridTree : public SpatialIndex<GridTree<OBJ_T>, OBJ_T>
 {
     private:
         struct Node
@@ -263,6 +545,7 @@ class GridTree
             std::vector<Rect> _vCellAreas{}; // areas of children cell
             std::vector<std::shared_ptr<Node>> _vCellNodes{}; // children cell of the node
             std::vector<std::vector<OBJ_T>> _vCellObjects; // the objects belonging to the cell
+            std::vector<float> _vCellMaxSize; // size of the largest object of the cell
 
             Node(Rect& r, Vec2<size_t> cellCounts) : _area(r)
             {
@@ -271,6 +554,7 @@ class GridTree
                 _cellSize.y = r.size.y / _cellCounts.y;
                 _vCellAreas.resize(_cellCounts.x * _cellCounts.y);
                 _vCellObjects.resize(_cellCounts.x * _cellCounts.y);  
+                _vCellMaxSize.resize(_cellCounts.x * _cellCounts.y, 0.0f);
 
                 for (size_t y = 0; y < _cellCounts.y; y++)
                 {
@@ -285,6 +569,21 @@ class GridTree
         std::shared_ptr<Node> _root;
         Rect _area = {{0.0f, 0.0f}, {100.0f, 100.0f}};
         Vec2<size_t> _cellCounts = {0, 0};
+        mutable size_t _queries = 0; // for the statistics
+        mutable size_t _nodesVisited = 0;
+        mutable size_t _objectsTested = 0;
+
+        // largest side of the object
+        static float objectSize(const Rect& area)
+        {
+            return std::max(area.size.x, area.size.y);
+        }
+
+        // an object is stored in every cell it touches
+        static bool inCell(const Rect& cell, const Rect& area)
+        {
+            return cell.contains(area) || cell.overlaps(area);
+        }
 
         void insert(std::shared_ptr<Node>& node, const OBJ_T& obj)
         {
@@ -292,35 +591,73 @@ class GridTree
 
             for (auto it=node->_vCellAreas.begin(); it!=node->_vCellAreas.end(); ++it)
             {
-                if (it->contains(obj.GetArea()) || it->overlaps(obj.GetArea()))
+                if (inCell(*it, obj.GetArea()))
                 {
-                    node->_vCellObjects[it-node->_vCellAreas.begin()].push_back(obj);
+                    size_t cell = it - node->_vCellAreas.begin();
+                    node->_vCellObjects[cell].push_back(obj);
+                    node->_vCellMaxSize[cell] = std::max(node->_vCellMaxSize[cell], objectSize(obj.GetArea()));
                 }
             }
             return;
         }
 
-        void search(std::shared_ptr<Node>& node, const Rect& r, std::list<OBJ_T>& result) const
+        // the columns (or rows) of cells overlapping [v0, v1], empty if first > last
+        static void cellRange(float v0, float v1, float origin, float cellSize, size_t count, size_t& first, size_t& last)
         {
-            for (auto it=node->_vCellAreas.begin(); it!=node->_vCellAreas.end(); ++it)
+            float c0 = std::floor((v0 - origin) / cellSize);
+            float c1 = std::floor((v1 - origin) / cellSize);
+            first = (size_t)std::max(0.0f, c0);
+            last = (size_t)std::min((float)count - 1.0f, c1);
+            if (c1 < 0.0f || c0 >= (float)count) { first = 1; last = 0; }
+        }
+
+        template <class FUNC>
+        void search(const std::shared_ptr<Node>& node, const Rect& r, float minSize, FUNC& f) const
+        {
+            if (!node) return;
+
+            // only the cells under r, a cell more on each side for the rounding
+            size_t x0, x1, y0, y1;
+            cellRange(r.pos.x - node->_cellSize.x, r.pos.x + r.size.x + node->_cellSize.x, node->_area.pos.x, node->_cellSize.x, node->_cellCounts.x, x0, x1);
+            cellRange(r.pos.y - node->_cellSize.y, r.pos.y + r.size.y + node->_cellSize.y, node->_area.pos.y, node->_cellSize.y, node->_cellCounts.y, y0, y1);
+            if (x0 > x1 || y0 > y1) return;
+
+            // first column and row of cells overlapping r
+            size_t firstX = x1 + 1, firstY = y1 + 1;
+            for (size_t x = x0; x <= x1 && firstX > x1; x++)
             {
-                if (r.contains(*it))
-                {
-                    for (const auto& obj : node->_vCellObjects[it-node->_vCellAreas.begin()])
-                    {
-                        result.push_back(obj);
-                    }
-                }
-                if (r.overlaps(*it))
+                const Rect& c = node->_vCellAreas[y0 * node->_cellCounts.x + x];
+                if (r.pos.x < c.pos.x + c.size.x && r.pos.x + r.size.x >= c.pos.x) firstX = x;
+            }
+            for (size_t y = y0; y <= y1 && firstY > y1; y++)
+            {
+                const Rect& c = node->_vCellAreas[y * node->_cellCounts.x + x0];
+                if (r.pos.y < c.pos.y + c.size.y && r.pos.y + r.size.y >= c.pos.y) firstY = y;
+            }
+
+            for (size_t y = y0; y <= y1; y++)
+            {
+                for (size_t x = x0; x <= x1; x++)
                 {
-                    for (const auto& obj : node->_vCellObjects[it-node->_vCellAreas.begin()])
+                    size_t cell = y * node->_cellCounts.x + x;
+                    const Rect& cellArea = node->_vCellAreas[cell];
+                    _nodesVisited++;
+                    if (node->_vCellMaxSize[cell] < minSize) continue; // only smaller objects
+                    if (!r.overlaps(cellArea)) continue;
+
+                    _objectsTested += node->_vCellObjects[cell].size();
+                    for (const auto& obj : node->_vCellObjects[cell])
                     {
-                        if (r.overlaps(obj.GetArea()) || r.contains(obj.GetArea()))
-                            result.push_back(obj);
+                        Rect area = obj.GetArea();
+                        if (!r.overlaps(area) || objectSize(area) < minSize) continue;
+
+                        // an object of several cells is only reported by the first one under r
+                        if (x > firstX && inCell(node->_vCellAreas[cell - 1], area)) continue;
+                        if (y > firstY && inCell(node->_vCellAreas[cell - node->_cellCounts.x], area)) continue;
+                        f(obj);
                     }
                 }
             }
-            return;
         }
 
         void print(const std::shared_ptr<Node>& node) const
@@ -330,6 +667,7 @@ class GridTree
 
 
     public:
+        using SpatialIndex<GridTree<OBJ_T>, OBJ_T>::search;
 
         GridTree(): _root(nullptr) {};
 
@@ -341,18 +679,54 @@ class GridTree
 
         void insert(const OBJ_T& obj)
         {
+            TRACE_SCOPE("GridTree::insert");
             insert(_root, obj);
         }
 
-        std::list<OBJ_T> search(const Rect& r)
+        void clear()
         {
-            std::list<OBJ_T> result;
-            search(_root, r, result);
-            return result;
+            _root = nullptr;
+        }
+
+        // f(obj) once for the objects overlapping r, without those smaller than minSize
+        template <class FUNC>
+        void for_each_in(const Rect& r, float minSize, FUNC&& f)
+        {
+            TRACE_SCOPE("GridTree::search");
+            _queries++;
+            search(_root, r, minSize, f);
+        }
+
+        // removed from all its cells, the object must still have the bounds it was inserted with
+        bool remove(const OBJ_T& obj)
+        {
+            if (!_root) return false;
+
+            bool bRemoved = false;
+            Rect area = obj.GetArea();
+            for (size_t cell = 0; cell < _root->_vCellAreas.size(); cell++)
+            {
+                if (!inCell(_root->_vCellAreas[cell], area)) continue;
+
+                auto& objects = _root->_vCellObjects[cell];
+                for (size_t i = 0; i < objects.size(); i++)
+                {
+                    if (objects[i] == obj)
+                    {
+                        objects[i] = objects.back();
+                        objects.pop_back();
+                        bRemoved = true;
+                        break;
+                    }
+                }
+            }
+            return bRemoved;
         }
 
+        // entries of the cells, an object of several cells is counted in each
         size_t size() const 
         { 
+            if (!_root) return 0;
             size_t s = 0;
             for (const auto& cell : _root->_vCellObjects)
             {
@@ -360,117 +734,237 @@ class GridTree
             }
             return s;
         }
-    
+
+        // the root node at depth 0 and its cells at depth 1
+        IndexStats stats() const
+        {
+            IndexStats s;
+            if (!_root) return s;
+
+            s.addNode(0, 0);
+            s.nodeBytes += sizeof(Node);
+            s.overheadBytes += IndexStats::SHARED_PTR_BLOCK;
+
+            for (const auto& cell : _root->_vCellObjects)
+            {
+                s.addNode(1, cell.size());
+                s.nodeBytes += sizeof(Rect) + sizeof(cell);
+                s.payloadBytes += cell.size() * sizeof(OBJ_T);
+                s.overheadBytes += (cell.capacity() - cell.size()) * sizeof(OBJ_T);
+            }
+
+            s.queries = _queries;
+            s.avgNodesVisited = _queries ? (double)_nodesVisited / _queries : 0.0;
+            return s;
+        }
+
+        size_t tested() const
+        {
+            return _nodesVisited + _objectsTested;
+        }
 };
 
 
 template <typename OBJ_T>
-class KDTree 
+class KDTree : public SpatialIndex<KDTree<OBJ_T>, OBJ_T>
 {
     protected:
+        // bounds of the object areas of a subtree, the objects are not points:
+        // a circle centred on one side of a split can reach the other side
+        struct Bounds
+        {
+            float x0 = FLT_MAX, y0 = FLT_MAX;
+            float x1 = -FLT_MAX, y1 = -FLT_MAX;
+
+            void add(const Rect& a)
+            {
+                x0 = std::min(x0, a.pos.x);
+                y0 = std::min(y0, a.pos.y);
+                x1 = std::max(x1, a.pos.x + a.size.x);
+                y1 = std::max(y1, a.pos.y + a.size.y);
+            }
+
+            void add(const Bounds& b)
+            {
+                x0 = std::min(x0, b.x0);
+                y0 = std::min(y0, b.y0);
+                x1 = std::max(x1, b.x1);
+                y1 = std::max(y1, b.y1);
+            }
+
+            // as r.overlaps() of one of the areas, necessary for any object of the subtree
+            bool overlappedBy(const Rect& r) const
+            {
+                return r.pos.x < x1 && r.pos.x + r.size.x >= x0 && r.pos.y < y1 && r.pos.y + r.size.y >= y0;
+            }
+
+            // r overlaps all the areas of the subtree
+            bool containedIn(const Rect& r) const
+            {
+                return r.pos.x < x0 && r.pos.x + r.size.x >= x1 && r.pos.y < y0 && r.pos.y + r.size.y >= y1;
+            }
+        };
+
         // Node structure representing each point in the KDTree
         struct Node 
         {
-            Rect _area;
             OBJ_T _object;
             std::shared_ptr<Node> _left;          
             std::shared_ptr<Node> _right;
-            std::array<Rect, 2> _vRects;
+            Bounds _bounds; // of the objects of the subtree
             int _depth;
+            float _maxSize = 0.0f; // size of the largest object of the subtree
+            bool _bRemoved = false; // kept as a split point, skipped by the queries
                     
             // Constructor to initialize a Node
-            Node(const OBJ_T& ob, const Rect& r={{0.0f, 0.0f}, {100.0f, 100.0f}}, int d=0) : 
+            Node(const OBJ_T& ob, int d=0) : 
                 _object(ob),
-                _depth(d),
                 _left(nullptr), 
                 _right(nullptr),
-                _area(r)
+                _depth(d)
             {
-                // Calculate the bounding rectangles for the left and right children
-                if (_depth % 2 == 0)
-                {
-                    _vRects[0] = r.leftRect(ob.pos);
-                    _vRects[1] = r.rightRect(ob.pos);
-                }
-                else
-                {
-                    _vRects[0] = r.lowerRect(ob.pos);
-                    _vRects[1] = r.upperRect(ob.pos);
-                }
+                _bounds.add(ob.GetArea());
             }
         };
 
         std::shared_ptr<Node> _root; // Root of the KDTree
         Rect _area = {{0.0f, 0.0f}, {100.0f, 100.0f}};
+        size_t _queries = 0; // for the statistics
+        size_t _nodesVisited = 0;
+        size_t _candidates = 0; // objects tested exactly
+        size_t _found = 0;
+
+        // largest side of the object
+        static float objectSize(const Rect& area)
+        {
+            return std::max(area.size.x, area.size.y);
+        }
 
         // Recursive function to insert a point into the KDTree
-        void insert(std::shared_ptr<Node>& node, const Rect& r, const OBJ_T& ob, int depth) 
+        void insert(std::shared_ptr<Node>& node, const OBJ_T& ob, int depth) 
         {
             
             // Base case: If node is null, create a new node
             if (node == nullptr) 
             {
-                node =  std::make_shared<Node>(ob, r, depth);
+                node =  std::make_shared<Node>(ob, depth);
+                node->_maxSize = objectSize(ob.GetArea());
                 return;
             }
-            
+            node->_maxSize = std::max(node->_maxSize, objectSize(ob.GetArea()));
+            node->_bounds.add(ob.GetArea());
 
             // Calculate current dimension (cd)
             int cd = depth % 2;
 
             // Compare point with current node and decide to go left or right
             if (ob.pos[cd] < node->_object.pos[cd])
-                insert(node->_left, node->_vRects[0], ob, depth + 1);
+                insert(node->_left, ob, depth + 1);
             else
-                insert(node->_right, node->_vRects[1], ob, depth + 1);
+                insert(node->_right, ob, depth + 1);
 
             return;
         }
 
-        void search(const std::shared_ptr<Node>& node, const Rect& r, std::list<OBJ_T>& results) 
+        // balanced subtree of the objects of [first, last): the median of the
+        // axis is the split point, the smaller ones on the left as for insert
+        using Iterator = typename std::vector<OBJ_T>::iterator;
+        void build(std::shared_ptr<Node>& node, Iterator first, Iterator last, int depth)
+        {
+            if (first == last) return;
+
+            int cd = depth % 2;
+            Iterator mid = first + (last - first) / 2;
+            std::nth_element(first, mid, last, [cd](const OBJ_T& a, const OBJ_T& b) { return a.pos[cd] < b.pos[cd]; });
+            float split = mid->pos[cd];
+            mid = std::partition(first, last, [cd, split](const OBJ_T& o) { return o.pos[cd] < split; });
+            std::iter_swap(mid, std::find_if(mid, last, [cd, split](const OBJ_T& o) { return o.pos[cd] == split; }));
+
+            node = std::make_shared<Node>(*mid, depth);
+            node->_maxSize = objectSize(mid->GetArea());
+            build(node->_left, first, mid, depth + 1);
+            build(node->_right, mid + 1, last, depth + 1);
+            for (const auto& child : {node->_left, node->_right})
+            {
+                if (child == nullptr) continue;
+                node->_maxSize = std::max(node->_maxSize, child->_maxSize);
+                node->_bounds.add(child->_bounds);
+            }
+        }
+
+        // the subtrees are pruned on the bounds of their objects, not on the split regions
+        template <class FUNC>
+        void search(const std::shared_ptr<Node>& node, const Rect& r, float minSize, FUNC& f) 
         {
             // Base case: If node is null, the point is not found
             if (node == nullptr) return;
+            _nodesVisited++;
+            if (node->_maxSize < minSize) return; // only smaller objects in the subtree
+            if (!node->_bounds.overlappedBy(r)) return;
+            if (node->_bounds.containedIn(r))
+            {
+                items(node, minSize, f);
+                return;
+            }
 
-            // Calculate current dimension (cd)
-            int cd = node->_depth % 2;
-
-            if (r.overlaps(node->_object.GetArea()))
-                results.push_back(node->_object);
-                
-            // Compare point with current node and decide to go left or right
-            if (r.contains(node->_vRects[0]))
+            if (!node->_bRemoved)
             {
-                items(node->_left, results);
+                _candidates++;
+                Rect area = node->_object.GetArea();
+                if (r.overlaps(area) && objectSize(area) >= minSize)
+                {
+                    f(node->_object);
+                    _found++;
+                }
             }
-                
-            else if (r.overlaps(node->_vRects[0]))
-                search(node->_left, r, results);
-            if (r.contains(node->_vRects[1]))
-                items(node->_right, results);
-            else if (r.overlaps(node->_vRects[1]))
-                search(node->_right, r, results);
-    
+
+            search(node->_left, r, minSize, f);
+            search(node->_right, r, minSize, f);
         }
 
-        void items(const std::shared_ptr<Node>& node, std::list<OBJ_T>& results)
+        // the search of the centres only, in the split regions, with r inflated by the
+        // largest object: the objects tested exactly, to compare with the bounds
+        size_t inflatedCandidates(const std::shared_ptr<Node>& node, const Rect& region, const Rect& r) const
+        {
+            if (node == nullptr || !r.overlaps(region)) return 0;
+
+            size_t n = node->_bRemoved ? 0 : 1;
+            const Vec2<float>& pos = node->_object.pos;
+            if (node->_depth % 2 == 0)
+                return n + inflatedCandidates(node->_left, region.leftRect(pos), r) +
+                           inflatedCandidates(node->_right, region.rightRect(pos), r);
+            return n + inflatedCandidates(node->_left, region.lowerRect(pos), r) +
+                       inflatedCandidates(node->_right, region.upperRect(pos), r);
+        }
+
+        template <class FUNC>
+        void items(const std::shared_ptr<Node>& node, float minSize, FUNC& f)
         {
             // Base case: If node is null, return
             if (node == nullptr) return;
+            _nodesVisited++;
+            if (node->_maxSize < minSize) return;
 
             // Add current node to the results list
-            results.push_back(node->_object);
+            if (!node->_bRemoved && objectSize(node->_object.GetArea()) >= minSize)
+                f(node->_object);
 
             // Recursively add items from left and right children
-            items(node->_left, results);
-            items(node->_right, results);
+            items(node->_left, minSize, f);
+            items(node->_right, minSize, f);
         }
 
-        std::list<OBJ_T> items(const std::shared_ptr<Node>& node)
+        // the node of the object, found by the path of the insert
+        Node* find(const OBJ_T& ob) const
         {
-            std::list<OBJ_T> results;
-            items(node, results);
-            return results;
+            Node* node = _root.get();
+            while (node != nullptr)
+            {
+                if (!node->_bRemoved && node->_object == ob) return node;
+                int cd = node->_depth % 2;
+                node = (ob.pos[cd] < node->_object.pos[cd]) ? node->_left.get() : node->_right.get();
+            }
+            return nullptr;
         }
 
         // Recursive function to print the KDTree
@@ -492,10 +986,26 @@ class KDTree
             print(node->_right, depth + 1);
         }
 
+        // recursive collect of the statistics of a node and its children
+        void stats(const std::shared_ptr<Node>& node, IndexStats& s) const
+        {
+            if (node == nullptr) return;
+
+            s.addNode(node->_depth, node->_bRemoved ? 0 : 1);
+            s.nodeBytes += sizeof(Node) - sizeof(OBJ_T);
+            s.payloadBytes += sizeof(OBJ_T);
+            s.overheadBytes += IndexStats::SHARED_PTR_BLOCK;
+
+            stats(node->_left, s);
+            stats(node->_right, s);
+        }
+
         size_t size(const std::shared_ptr<Node>& node) const
         {
             size_t s = 0;
-            if (node != nullptr)
+            if (node == nullptr)
+                return s;
+            if (!node->_bRemoved)
                 s += 1;
             if (node->_left!= nullptr)
                 s += size(node->_left);
@@ -507,6 +1017,8 @@ class KDTree
 
     public:
         // Constructor to initialize the KDTree with a null root
+        using SpatialIndex<KDTree<OBJ_T>, OBJ_T>::search;
+
         KDTree() : _root(nullptr) {}
 
         void SetArea(const Rect r)
@@ -516,20 +1028,65 @@ class KDTree
 
         // Public function to insert a point into the KDTree
         void insert(const OBJ_T& ob) {
-            insert(_root, _area, ob, 0);
+            TRACE_SCOPE("KDTree::insert");
+            insert(_root, ob, 0);
+        }
+
+        // balanced tree of all the objects, instead of the order of the inserts
+        void build(const std::vector<OBJ_T>& objects)
+        {
+            TRACE_SCOPE("KDTree::build");
+            clear();
+            std::vector<OBJ_T> sorted(objects);
+            build(_root, sorted.begin(), sorted.end(), 0);
+        }
+
+        void clear()
+        {
+            _root = nullptr;
         }
 
-        // Public function to search for a point in the KDTree
+        // whether an object is at the point, found by the path of the insert
         bool search(const Vec2<float>& point) const {
-            return search(_root, point, 0);
+            const Node* node = _root.get();
+            while (node != nullptr)
+            {
+                if (!node->_bRemoved && node->_object.pos == point) return true;
+                int cd = node->_depth % 2;
+                node = (point[cd] < node->_object.pos[cd]) ? node->_left.get() : node->_right.get();
+            }
+            return false;
         }
 
-        // Public function to search for a point in the KDTree
-        std::list<OBJ_T> search(const Rect& r) 
+        // f(obj) for the objects overlapping r, without those smaller than minSize
+        template <class FUNC>
+        void for_each_in(const Rect& r, float minSize, FUNC&& f)
         {
-            std::list<OBJ_T> result;
-            search(_root, r, result);
-            return result;
+            TRACE_SCOPE("KDTree::search");
+            _queries++;
+            search(_root, r, minSize, f);
+        }
+
+        // objects tested exactly by the search of r, with the bounds of the subtrees
+        // and with the split regions and r inflated by the largest object
+        void candidates(const Rect& r, size_t& bounds, size_t& inflated)
+        {
+            size_t before = _candidates;
+            for_each_in(r, 0.0f, [](const OBJ_T&) {});
+            bounds = _candidates - before;
+
+            float margin = _root ? _root->_maxSize / 2.0f : 0.0f;
+            Rect grown = {r.pos - margin, {r.size.x + 2.0f * margin, r.size.y + 2.0f * margin}};
+            inflated = inflatedCandidates(_root, _area, grown);
+        }
+
+        // the node stays as a split point of its subtree, it is only skipped
+        bool remove(const OBJ_T& ob)
+        {
+            Node* node = find(ob);
+            if (node == nullptr) return false;
+            node->_bRemoved = true;
+            return true;
         }
 
         // Public function to print the KDTree
@@ -541,6 +1098,118 @@ class KDTree
         {
             return size(_root);
         }
+
+        IndexStats stats() const
+        {
+            IndexStats s;
+            stats(_root, s);
+            s.queries = _queries;
+            s.avgNodesVisited = _queries ? (double)_nodesVisited / _queries : 0.0;
+            s.candidates = _candidates;
+            s.found = _found;
+            return s;
+        }
+
+        // a node holds one object, tested at most once per visit
+        size_t tested() const
+        {
+            return _nodesVisited + _candidates;
+        }
+};
+
+
+// the linear search as an index: the columns of the entity store are scanned,
+// it only keeps the number of ids indexed and the removed ones
+template <class OBJ_T>
+class LinearIndex : public SpatialIndex<LinearIndex<OBJ_T>, OBJ_T>
+{
+    private:
+        const EntityStore* _pStore = nullptr;
+        size_t _count = 0; // ids [0, _count) of the store
+        std::vector<bool> _vRemoved;
+        size_t _removed = 0;
+        size_t _queries = 0;
+        size_t _objectsTested = 0;
+
+    public:
+        void SetStore(const EntityStore* pStore)
+        {
+            _pStore = pStore;
+        }
+
+        // the object is already in the store, only its id is indexed
+        void insert(const OBJ_T& obj)
+        {
+            _count = std::max(_count, (size_t)obj.id + 1);
+            if (_removed) _vRemoved.resize(_count, false); // read by the search once an object is removed
+            if (obj.id < _vRemoved.size() && _vRemoved[obj.id])
+            {
+                _vRemoved[obj.id] = false;
+                _removed--;
+            }
+        }
+
+        void clear()
+        {
+            _count = 0;
+            _vRemoved.clear();
+            _removed = 0;
+        }
+
+        // f(obj) for the objects overlapping r, without those smaller than minSize
+        template <class FUNC>
+        void for_each_in(const Rect& r, float minSize, FUNC&& f)
+        {
+            TRACE_SCOPE("LinearIndex::search");
+            _queries++;
+            _objectsTested += _count;
+            const float* xs = _pStore->getXs();
+            const float* ys = _pStore->getYs();
+            const float* rs = _pStore->getRadii();
+            float x1 = r.pos.x + r.size.x;
+            float y1 = r.pos.y + r.size.y;
+            for (EntityStore::Id id = 0; id < _count; id++)
+            {
+                // as r.overlaps() of the object area, on the columns
+                float d = 2.0f * rs[id];
+                float ox = xs[id] - rs[id];
+                float oy = ys[id] - rs[id];
+                if (r.pos.x < ox + d && x1 >= ox && r.pos.y < oy + d && y1 >= oy && d >= minSize &&
+                    (!_removed || !_vRemoved[id]))
+                    f(OBJ_T{id});
+            }
+        }
+
+        bool remove(const OBJ_T& obj)
+        {
+            if (obj.id >= _count) return false;
+            if (_vRemoved.size() < _count) _vRemoved.resize(_count, false);
+            if (_vRemoved[obj.id]) return false;
+            _vRemoved[obj.id] = true;
+            _removed++;
+            return true;
+        }
+
+        size_t size() const
+        {
+            return _count - _removed;
+        }
+
+        // a single node of all the objects, each query tests all of them
+        IndexStats stats() const
+        {
+            IndexStats s;
+            s.addNode(0, size());
+            s.overheadBytes += _vRemoved.capacity() / 8;
+            s.queries = _queries;
+            s.avgNodesVisited = _queries ? 1.0 : 0.0;
+            return s;
+        }
+
+        size_t tested() const
+        {
+            return _objectsTested;
+        }
 };
 
 
@@ -558,28 +1227,51 @@ class TreeApp: public SDLCommon
         TreeApp() {_appName = "Trees For Display";};
         ~TreeApp() = default;
 
+        // before init, the layout of the objects in memory
+        void setOrder(spatial::Order order) {_order = order;};
+
     protected:
-        struct CObject
+        // what the indices store of an object: its id in the entity store and its bounds
+        struct IndexItem
         {
+            EntityStore::Id id = 0;
             Vec2<float> pos = {0.0f, 0.0f};
-            Vec2<float> vel = {0.0f, 0.0f};
-            Vec2<float> size = {0.0f, 0.0f};
             float r = 1.0f;
-            SDL_Color color = {0, 0, 0, 255};
             Rect GetArea() const {return {pos-r, {r * 2.0f, r * 2.0f}};};
+            bool operator==(const IndexItem& item) const {return id == item.id;};
+        };
+
+        // what the quadtree stores: only the id, its nodes keep the quantised bounds
+        // and the exact ones are read from the store for the candidates
+        struct EntityRef
+        {
+            EntityStore::Id id = 0;
+            inline static const EntityStore* pStore = nullptr;
+            Rect GetArea() const
+            {
+                float r = pStore->getRadius(id);
+                return {{pStore->getX(id) - r, pStore->getY(id) - r}, {r * 2.0f, r * 2.0f}};
+            };
+            bool operator==(const EntityRef& ref) const {return id == ref.id;};
         };
 
         float areaLength = MAX_ENTITY_SIZE * 1000.0f;
-        std::vector<CObject> _vObjects;
-        StaticQuadTree<CObject> _staticQuadTree;
-        GridTree<CObject> _gridTree;
-        KDTree<CObject> _kdTree;
+        EntityStore _entities; // the objects, shared by the indices
+        LinearIndex<EntityRef> _linear;
+        StaticQuadTree<EntityRef> _staticQuadTree;
+        GridTree<IndexItem> _gridTree;
+        KDTree<IndexItem> _kdTree;
 
         UseTree _useMethod = UseTree::GRID; // option to use QuadTree
+        spatial::Order _order = spatial::Order::HILBERT; // of the store, so of the index payloads
+        std::vector<EntityStore::Id> _vVisible; // objects found by the query, reused each frame
+        int _phaseQuery;
+        int _phaseRaster;
 
         bool onUserInit() override 
         {
             // initialize the tree
+            EntityRef::pStore = &_entities;
             _staticQuadTree.SetArea({{0.0f, 0.0f}, {areaLength, areaLength}});
             _gridTree.SetArea({{0.0f, 0.0f}, {areaLength, areaLength}}, {20, 20});
             _kdTree.SetArea({{0.0f, 0.0f}, {areaLength, areaLength}});
@@ -588,26 +1280,30 @@ class TreeApp: public SDLCommon
                 return (float)rand() / (float)RAND_MAX * (y - x) + x;
             };
 
+            _entities.reserve(NUM_ENTITIES);
             for (int i = 0; i < NUM_ENTITIES; i++)
             {
-                CObject obj;
-                obj.pos.x = randf(0.0f, areaLength);
-                obj.pos.y = randf(0.0f, areaLength);
-                obj.r = randf(0.0f, MAX_ENTITY_SIZE);
-                obj.size.x = 2.0f * obj.r;
-                obj.size.y = 2.0f * obj.r;
-                obj.color = {(Uint8)(rand()%256), (Uint8)(rand()%256), (Uint8)(rand()%256)};
-                _vObjects.push_back(obj);
-                _staticQuadTree.insert(obj); // insert objects in quadtree
-                _gridTree.insert(obj);
-                _kdTree.insert(obj);
+                float x = randf(0.0f, areaLength);
+                float y = randf(0.0f, areaLength);
+                float r = randf(0.0f, MAX_ENTITY_SIZE);
+                SDL_Color color = {(Uint8)(rand()%256), (Uint8)(rand()%256), (Uint8)(rand()%256)};
+                _entities.add(x, y, r, color);
             }
 
+            // the store sorted along the curve, then the bulk build of the indices
+            _linear.SetStore(&_entities);
+            applyOrder(_order);
+
+            _vVisible.reserve(_entities.size());
+            _phaseQuery = _profiler.addPhase("query");
+            _phaseRaster = _profiler.addPhase("raster");
+
             // Show some  information
-            std::cout << "objs created: " << _vObjects.size() << std::endl;
+            std::cout << "objs created: " << _entities.size() << std::endl;
             std::cout << "objs in QuadTree: " << _staticQuadTree.size() << std::endl;
             std::cout << "objs in GridTree: " << _gridTree.size() << std::endl;
             std::cout << "objs in KDTree: " << _kdTree.size() << std::endl;
+            printStats();
   
             // // uncomment this section to show the tree structure
             // std::cout << "objs tree: " << std::endl;
@@ -616,15 +1312,217 @@ class TreeApp: public SDLCommon
             return true;
         };
 
+        // the store sorted in the order and the indices rebuilt from it. The objects
+        // close in space are then close in the columns and in the index payloads.
+        void applyOrder(spatial::Order order)
+        {
+            auto ticStart = std::chrono::steady_clock::now();
+            std::vector<EntityStore::Id> permutation;
+            spatial::computeOrder(order, _entities.getXs(), _entities.getYs(), _entities.size(),
+                                  0.0f, 0.0f, areaLength, areaLength, permutation, _threadPool);
+            _entities.reorder(permutation);
+            std::chrono::duration<double, std::milli> sortDuration = std::chrono::steady_clock::now() - ticStart;
+
+            buildIndices();
+            std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - ticStart;
+            std::cout << "DEBUG - objects in " << spatial::getName(order) << " order (sort " << sortDuration.count()
+                      << " ms, with the indices " << duration.count() << " ms)" << std::endl;
+            _order = order;
+            markDirty();
+        }
+
+        // bulk build of the indices, in the order of the store
+        void buildIndices()
+        {
+            std::vector<IndexItem> items(_entities.size());
+            std::vector<EntityRef> refs(_entities.size());
+            for (EntityStore::Id id = 0; id < _entities.size(); id++)
+            {
+                items[id].id = id;
+                items[id].pos = {_entities.getX(id), _entities.getY(id)};
+                items[id].r = _entities.getRadius(id);
+                refs[id].id = id;
+            }
+
+            _linear.build(refs);
+            _staticQuadTree.build(refs);
+            _gridTree.build(items);
+            _kdTree.build(items);
+        }
+
+        void onUserStop() override
+        {
+            // the query statistics are only meaningful after some frames
+            printStats();
+        }
+
+        // memory and structure of all indices
+        void printStats() const
+        {
+            std::cout << "ENTITIES: " << _entities.size() << " objects, "
+                      << _entities.memoryBytes() / (1024.0 * 1024.0) << " MB, "
+                      << sizeof(IndexItem) << " bytes per index entry, "
+                      << sizeof(EntityRef) << " in the quadtree" << std::endl;
+            _linear.stats().print(std::cout, "LINEAR");
+            _staticQuadTree.stats().print(std::cout, "QUADTREE");
+            _gridTree.stats().print(std::cout, "GRID");
+            _kdTree.stats().print(std::cout, "KDTREE");
+        }
+
+        static constexpr int QUERIES = 200;
+
+        Rect randomView(float viewLength) const
+        {
+            return {{(float)rand() / RAND_MAX * (areaLength - viewLength), 
+                     (float)rand() / RAND_MAX * (areaLength - viewLength)}, 
+                    {viewLength, viewLength}};
+        }
+
+        // the same views for each index, at several zooms, to compare the queries alone
+        template <class INDEX>
+        void benchmarkIndex(INDEX& index, const char* name, std::ostream& os)
+        {
+            srand(1);
+            os << name << ":";
+            for (float viewLength : {areaLength / 100.0f, areaLength / 10.0f, areaLength / 2.0f})
+            {
+                size_t found = 0;
+                auto ticStart = std::chrono::steady_clock::now();
+                for (int i = 0; i < QUERIES; i++)
+                    index.for_each_in(randomView(viewLength), 0.0f, [&found](const auto&) { found++; });
+                std::chrono::duration<double, std::micro> us = std::chrono::steady_clock::now() - ticStart;
+                os << "  view " << viewLength << ": " << us.count() / QUERIES << " us/query, " 
+                   << found / QUERIES << " objects";
+            }
+            os << std::endl;
+        }
+
+        // queries of a view of 10% of the area, then reads of the attributes of the
+        // objects found as for the draw, with the cache misses if the counters are permitted
+        template <class INDEX>
+        void benchmarkGather(INDEX& index, const char* name, PerfCounters& counters, std::ostream& os)
+        {
+            srand(1);
+            float viewLength = areaLength / 10.0f;
+            float sum = 0.0f;
+            PerfCounters::Values before, after;
+            counters.read(before);
+            auto ticStart = std::chrono::steady_clock::now();
+            for (int i = 0; i < QUERIES; i++)
+            {
+                index.for_each_in(randomView(viewLength), 0.0f, [this, &sum](const auto& item)
+                {
+                    sum += _entities.getX(item.id) + _entities.getY(item.id) + _entities.getRadius(item.id) + 
+                           _entities.getColor(item.id).r;
+                });
+            }
+            std::chrono::duration<double, std::micro> us = std::chrono::steady_clock::now() - ticStart;
+            counters.read(after);
+
+            os << "  " << name << ": " << us.count() / QUERIES << " us/query";
+            if (counters.isOpen())
+            {
+                for (PerfCounters::Counter c : {PerfCounters::L1D_MISSES, PerfCounters::LLC_MISSES})
+                {
+                    if (counters.hasCounter(c))
+                        os << ", " << (after.v[c] - before.v[c]) / QUERIES << " " << PerfCounters::getName(c);
+                }
+            }
+            os << (sum < 0.0f ? " " : "") << std::endl; // the reads are used
+        }
+
+        // the same queries with the store and the index payloads in each order
+        void benchmarkLayouts(std::ostream& os)
+        {
+            spatial::Order current = _order;
+            PerfCounters counters;
+            counters.open(); // only the time if not permitted
+
+            for (spatial::Order order : {spatial::Order::RANDOM, spatial::Order::MORTON, spatial::Order::HILBERT})
+            {
+                applyOrder(order);
+                os << "LAYOUT " << spatial::getName(order) << " (" << _entities.size() << " objects, per query)" << std::endl;
+                benchmarkGather(_linear, "LINEAR", counters, os);
+                benchmarkGather(_staticQuadTree, "QUADTREE", counters, os);
+                benchmarkGather(_gridTree, "GRID", counters, os);
+                benchmarkGather(_kdTree, "KDTREE", counters, os);
+            }
+            applyOrder(current);
+        }
+
+        // the traversal of all the objects of the quadtree, fanned out on the pool down
+        // to several depths. Each object reads its attributes from the store.
+        void benchmarkTraversal(std::ostream& os)
+        {
+            ThreadPool& pool = getThreadPool();
+            struct alignas(64) Slot { double sum = 0.0; size_t count = 0; }; // one cache line per thread
+            std::vector<Slot> vSlots(pool.getWorkerCount() + 1);
+
+            os << "TRAVERSAL of the quadtree (" << _staticQuadTree.size() << " objects, " 
+               << pool.getWorkerCount() + 1 << " threads)" << std::endl;
+            double sequential = 0.0;
+            for (int spawnDepth : {-1, 1, 2, 3, 4, 6}) // tasks spawned above spawnDepth, none at 0
+            {
+                for (auto& slot : vSlots) slot = Slot();
+                auto ticStart = std::chrono::steady_clock::now();
+                _staticQuadTree.parallel_items(pool, 0.0f, spawnDepth, [this, &pool, &vSlots](const EntityRef& ref)
+                {
+                    Slot& slot = vSlots[pool.getThreadIndex()];
+                    float r = _entities.getRadius(ref.id);
+                    slot.sum += sqrtf(_entities.getX(ref.id) * _entities.getY(ref.id)) * r * r;
+                    slot.count++;
+                });
+                std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - ticStart;
+
+                size_t count = 0;
+                for (const auto& slot : vSlots) count += slot.count;
+                if (spawnDepth < 0) sequential = ms.count();
+                os << "  " << (spawnDepth < 0 ? std::string("sequential") : "tasks to depth " + std::to_string(spawnDepth))
+                   << ": " << ms.count() << " ms, " << count << " objects, speedup " << sequential / ms.count() << std::endl;
+            }
+        }
+
+        void benchmarkIndices(std::ostream& os)
+        {
+            os << "INDEX BENCHMARK (" << _entities.size() << " objects)" << std::endl;
+            benchmarkIndex(_linear, "LINEAR", os);
+            benchmarkIndex(_staticQuadTree, "QUADTREE", os);
+            benchmarkIndex(_gridTree, "GRID", os);
+            benchmarkIndex(_kdTree, "KDTREE", os);
+
+            // objects tested exactly by the KD-tree, pruned on the bounds of the subtrees
+            // or on the split regions with the views grown by the largest object
+            srand(1);
+            os << "KDTREE exact tests:";
+            for (float viewLength : {areaLength / 100.0f, areaLength / 10.0f, areaLength / 2.0f})
+            {
+                size_t bounds = 0, inflated = 0;
+                for (int i = 0; i < QUERIES; i++)
+                {
+                    size_t b, n;
+                    _kdTree.candidates(randomView(viewLength), b, n);
+                    bounds += b;
+                    inflated += n;
+                }
+                os << "  view " << viewLength << ": " << bounds / QUERIES << " with the bounds, " 
+                   << inflated / QUERIES << " with the inflated view";
+            }
+            os << std::endl;
+        }
+
         void onUserUpdate(float frameTime) override 
         {
             // handle keyboard inputs
-            while (SDL_PollEvent(&_event) != 0)
+            while (pollEvent(_event))
             {
                 if (_event.type == SDL_QUIT)
                 {
                     _atomIsRunning = false;
                 }
+                else if (_event.type == SDL_WINDOWEVENT)
+                {
+                    markDirty(); // exposed or resized
+                }
                 else if (_event.type == SDL_MOUSEWHEEL)
                 {
                     if (_event.wheel.y > 0)
@@ -640,7 +1538,18 @@ class TreeApp: public SDLCommon
                 {
                     switch (_event.key.keysym.sym)
                     {
-                        case SDLK_TAB: _useMethod = (UseTree)(((int)_useMethod + 1) % 4); break; // add quadtree option
+                        case SDLK_F1: toggleProfilerOverlay(); break;
+                        case SDLK_F2: TRACE_EXPORT("trace.json"); break;
+                        case SDLK_F3: togglePerfCounters(); break;
+                        case SDLK_F4: benchmarkRaster(std::cout); break;
+                        case SDLK_F5: toggleBatch(); break;
+                        case SDLK_F7: toggleRedrawOnDemand(); break;
+                        case SDLK_F6: toggleTileCache(); break;
+                        case SDLK_F8: cycleSmallObjects(); break;
+                        case SDLK_F9: benchmarkIndices(std::cout); break;
+                        case SDLK_F10: benchmarkLayouts(std::cout); break;
+                        case SDLK_F11: benchmarkTraversal(std::cout); break;
+                        case SDLK_TAB: _useMethod = (UseTree)(((int)_useMethod + 1) % 4); markDirty(); break; // add quadtree option
                         case SDLK_UP: Pan(0, -10); break;
                         case SDLK_DOWN: Pan(0, 10); break;
                         case SDLK_LEFT: Pan(-10, 0); break;
@@ -650,91 +1559,107 @@ class TreeApp: public SDLCommon
             }  
         }
 
+        // the attributes of the object are read from the store
+        inline void drawEntity(EntityStore::Id id)
+        {
+            DrawFilledCircle({(int)_entities.getX(id), (int)_entities.getY(id)}, _entities.getRadius(id), _entities.getColor(id));
+        }
+
+        // the cached tiles are rendered from the grid, the fastest query
+        void onUserRenderTile(const SDL_Rect& world) override
+        {
+            _gridTree.for_each_in(Rect(world), getMinWorldSize(), [this](const IndexItem& item) { drawEntity(item.id); });
+        }
+
+        // query of the view then draw of the objects found, instantiated per index
+        template <class INDEX>
+        void renderIndex(INDEX& index, const char* name, const Rect& screen)
+        {
+            auto ticStart = std::chrono::system_clock::now();
+            size_t count = 0;
+            {
+                ScopedTimer t(_profiler, _phaseQuery);
+                _vVisible.clear();
+                size_t tested = index.tested();
+                index.for_each_in(screen, getMinWorldSize(), [this](const auto& item) { _vVisible.push_back(item.id); });
+                _profiler.addItems(_phaseQuery, index.tested() - tested); // the work of the query, not its results
+            }
+            {
+                ScopedTimer t(_profiler, _phaseRaster);
+                BeginBatch();
+                for (EntityStore::Id id : _vVisible)
+                {
+                    drawEntity(id);
+                    count++;
+                }
+                FlushBatch();
+                _profiler.addItems(_phaseRaster, count);
+            }
+            std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
+            std::string info = std::string(name) + ": " + 
+                            std::to_string(count) + "/" + 
+                            std::to_string(_entities.size()) + " Time: " + 
+                            std::to_string(ticDuration.count()) + " s";
+            DrawText(info, {10, 10}, TEXT_COLOR);
+        }
+
         void onUserRender() override
         {
             Rect screen = {getCameraViewport()};
-            size_t count = 0;
+
+            if (isTileCacheEnabled())
+            {
+                // the scene is static, the viewport is mostly blits of cached tiles
+                DrawCachedInfo(_phaseRaster, TEXT_COLOR);
+                return;
+            }
 
             switch(_useMethod)
             {
-                case(UseTree::LINEAR):
-                {
-                    auto ticStart = std::chrono::system_clock::now();
-                    for (const auto& obj : _vObjects)
-                    {
-                        if (screen.overlaps(obj.GetArea()))
-                        {
-                            DrawFilledCircle({(int)obj.pos.x, (int)obj.pos.y}, obj.r, obj.color);
-                            count++;
-                        }
-                    }
-                    std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
-                    std::string info = "LINEAR: "  + 
-                                    std::to_string(count) + "/" + 
-                                    std::to_string(_vObjects.size()) + " Time: " + 
-                                    std::to_string(ticDuration.count()) + " s";
-                    DrawText(info, {10, 10}, TEXT_COLOR);
-                    break;
-                }
-                case(UseTree::QUADTREE):
-                {
-                    auto ticStart = std::chrono::system_clock::now();
-                    Rect r = Rect(_cameraViewport);
-                    for (const auto& item : _staticQuadTree.search(r))
-                    {
-                        DrawFilledCircle({(int)item.pos.x, (int)item.pos.y}, item.r, item.color);
-                        count++;
-                    }
-                    std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
-                    std::string info = "QUADTREE: "  + 
-                                    std::to_string(count) + "/" + 
-                                    std::to_string(_vObjects.size()) + " Time: " + 
-                                    std::to_string(ticDuration.count()) + " s";
-                    DrawText(info, {10, 10}, TEXT_COLOR);
-                    break;
-                }
-                case(UseTree::GRID):
-                {
-                    auto ticStart = std::chrono::system_clock::now();
-                    for (const auto& obj : _gridTree.search(screen))
-                    {
-                        DrawFilledCircle({(int)obj.pos.x, (int)obj.pos.y}, obj.r, obj.color);
-                        count++;
-                    }
-                    std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
-                    std::string info = "GRID: " + 
-                                        std::to_string(count) + "/" + 
-                                        std::to_string(_vObjects.size()) + " Time: " + 
-                                        std::to_string(ticDuration.count()) + " s";
-                    DrawText(info, {10, 10}, TEXT_COLOR);
-                    break;
-                }
-                case(UseTree::KDTREE):
-                {
-                    auto ticStart = std::chrono::system_clock::now();
-                    for (const auto& obj : _kdTree.search(screen))
-                    {
-                        DrawFilledCircle({(int)obj.pos.x, (int)obj.pos.y}, obj.r, obj.color);
-                        count++;
-                    }
-                    std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
-                    std::string info = "KDTree: " + 
-                                        std::to_string(count) + "/" + 
-                                        std::to_string(_vObjects.size()) + " Time: " + 
-                                        std::to_string(ticDuration.count()) + " s";
-                    DrawText(info, {10, 10}, TEXT_COLOR);
-                    break;
-                }
+                case(UseTree::LINEAR): renderIndex(_linear, "LINEAR", screen); break;
+                case(UseTree::QUADTREE): renderIndex(_staticQuadTree, "QUADTREE", screen); break;
+                case(UseTree::GRID): renderIndex(_gridTree, "GRID", screen); break;
+                case(UseTree::KDTREE): renderIndex(_kdTree, "KDTree", screen); break;
             }
-              
         }
 };
 
 
-int main()
+int main(int argc, char* argv[])
 {
     TreeApp quadtree;
-    if (quadtree.init(800, 800, 20000, 20000))
+
+    // --zero-alloc: fail if a frame allocates after the warm-up frames
+    // --on-demand: only redraw when the view or the data changes
+    // --fps N: cap the frame rate
+    // --threaded: update on a fixed timestep thread, render on the main thread
+    // --small skip|splat: objects below one pixel skipped or splatted
+    // --order random|morton|hilbert: layout of the objects in memory
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--zero-alloc")
+            quadtree.setZeroAllocationCheck(60);
+        else if (arg == "--on-demand")
+            quadtree.setRedrawOnDemand(true);
+        else if (arg == "--fps" && i + 1 < argc)
+            quadtree.setFrameCap(atoi(argv[++i]));
+        else if (arg == "--threaded")
+            quadtree.setThreadedUpdate(true);
+        else if (arg == "--small" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+            quadtree.setSmallObjects(policy == "splat" ? SmallObjects::SPLAT : SmallObjects::SKIP);
+        }
+        else if (arg == "--order" && i + 1 < argc)
+        {
+            std::string order = argv[++i];
+            quadtree.setOrder(order == "random" ? spatial::Order::RANDOM : 
+                              order == "morton" ? spatial::Order::MORTON : spatial::Order::HILBERT);
+        }
+    }
+
+    if (quadtree.init(800, 800, 20000, 20000, RenderMode::SCREEN))
         quadtree.execute();
-    return 0;
+    return quadtree.hasFailed() ? 1 : 0;
 }
\ No newline at end of file
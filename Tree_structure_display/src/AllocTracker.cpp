@@ -0,0 +1,115 @@
+#include "AllocTracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace alloc
+{
+    namespace
+    {
+        // relaxed counters, the values are only read as snapshots
+        std::atomic<uint64_t> s_allocations{0};
+        std::atomic<uint64_t> s_bytes{0};
+        std::atomic<uint64_t> s_frees{0};
+
+        inline void countAllocation(size_t size)
+        {
+#ifdef ENABLE_ALLOC_TRACKER
+            s_allocations.fetch_add(1, std::memory_order_relaxed);
+            s_bytes.fetch_add(size, std::memory_order_relaxed);
+#else
+            (void)size;
+#endif
+        }
+
+        inline void countFree(void* p)
+        {
+#ifdef ENABLE_ALLOC_TRACKER
+            if (p) s_frees.fetch_add(1, std::memory_order_relaxed);
+#else
+            (void)p;
+#endif
+        }
+    }
+
+    Counts current()
+    {
+        Counts counts;
+        counts.allocations = s_allocations.load(std::memory_order_relaxed);
+        counts.bytes = s_bytes.load(std::memory_order_relaxed);
+        counts.frees = s_frees.load(std::memory_order_relaxed);
+        return counts;
+    }
+
+    void* trackedMalloc(size_t size)
+    {
+        countAllocation(size);
+        return malloc(size);
+    }
+
+    void* trackedCalloc(size_t n, size_t size)
+    {
+        countAllocation(n * size);
+        return calloc(n, size);
+    }
+
+    void* trackedRealloc(void* p, size_t size)
+    {
+        countAllocation(size);
+        return realloc(p, size);
+    }
+
+    void trackedFree(void* p)
+    {
+        countFree(p);
+        free(p);
+    }
+}
+
+#ifdef ENABLE_ALLOC_TRACKER
+
+// replacement of the global allocation functions
+
+namespace alloc
+{
+    namespace
+    {
+        void* trackedNew(size_t size)
+        {
+            if (size == 0) size = 1;
+            void* p = trackedMalloc(size);
+            if (!p) throw std::bad_alloc();
+            return p;
+        }
+
+        void* trackedAlignedNew(size_t size, std::align_val_t al)
+        {
+            if (size == 0) size = 1;
+            void* p = nullptr;
+            if (posix_memalign(&p, (size_t)al, size) != 0) throw std::bad_alloc();
+            countAllocation(size);
+            return p;
+        }
+    }
+}
+
+void* operator new(size_t size) { return alloc::trackedNew(size); }
+void* operator new[](size_t size) { return alloc::trackedNew(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return alloc::trackedMalloc(size ? size : 1); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return alloc::trackedMalloc(size ? size : 1); }
+void* operator new(size_t size, std::align_val_t al) { return alloc::trackedAlignedNew(size, al); }
+void* operator new[](size_t size, std::align_val_t al) { return alloc::trackedAlignedNew(size, al); }
+
+void operator delete(void* p) noexcept { alloc::trackedFree(p); }
+void operator delete[](void* p) noexcept { alloc::trackedFree(p); }
+void operator delete(void* p, size_t) noexcept { alloc::trackedFree(p); }
+void operator delete[](void* p, size_t) noexcept { alloc::trackedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { alloc::trackedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { alloc::trackedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { alloc::trackedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { alloc::trackedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { alloc::trackedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { alloc::trackedFree(p); }
+
+#endif
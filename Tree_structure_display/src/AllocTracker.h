@@ -0,0 +1,41 @@
+#pragma once
+
+// Global heap allocation accounting.
+//
+// When compiled with ENABLE_ALLOC_TRACKER (cmake -DENABLE_ALLOC_TRACKER=ON), the
+// global operator new/delete are replaced to count the allocations of the whole
+// program, and SDL is set to allocate through the same counters. The profiler
+// phases then report allocations per frame and per phase.
+// Without the option, nothing is replaced and the counters stay at 0.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace alloc
+{
+    struct Counts
+    {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0; // requested bytes
+        uint64_t frees = 0;
+    };
+
+    // whether the tracker is compiled in
+    constexpr bool isEnabled()
+    {
+#ifdef ENABLE_ALLOC_TRACKER
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // counts since the start of the program, all threads included
+    Counts current();
+
+    // malloc functions for SDL_SetMemoryFunctions
+    void* trackedMalloc(size_t size);
+    void* trackedCalloc(size_t n, size_t size);
+    void* trackedRealloc(void* p, size_t size);
+    void trackedFree(void* p);
+}
@@ -1,11 +1,23 @@
 #include "App.h"
 
 #include <algorithm>
+#include <chrono>
+
+#include "Raster.h"
 
 // constructor
 SDLCommon::SDLCommon()
 {
     _pTexture = nullptr;
+
+    // phases measured by the main loop
+    _phaseFrame = _profiler.addPhase("frame");
+    _phaseClear = _profiler.addPhase("clear");
+    _phaseUpdate = _profiler.addPhase("update");
+    _phaseRender = _profiler.addPhase("render");
+    _phaseText = _profiler.addPhase("text");
+    _phaseBlit = _profiler.addPhase("blit");
+    _phaseLatency = _profiler.addPhase("latency");
 }
 
 // destructor
@@ -17,6 +29,8 @@ SDLCommon::~SDLCommon()
         SDL_DestroyTexture(_pTexture);
     if (!_pTextTexture)
         SDL_DestroyTexture(_pTextTexture);
+    for (auto& hud : _vHudTexts)
+        SDL_FreeSurface(hud.surface);
     TTF_CloseFont(_pTextFont);
     _pTextFont = nullptr;
 
@@ -28,12 +42,17 @@ SDLCommon::~SDLCommon()
 }
 
 // init all sdl stuff and game related resources
-bool SDLCommon::init(int sw, int sh, int tw, int th)
+bool SDLCommon::init(int sw, int sh, int tw, int th, RenderMode mode)
 {
     _screenHeight = sh;
     _screenWidth = sw;
     _textureHeight = th;
     _textureWidth = tw;
+    _renderMode = mode;
+
+    // count the allocations of SDL with the tracker, must be set before any SDL allocation
+    if (alloc::isEnabled())
+        SDL_SetMemoryFunctions(alloc::trackedMalloc, alloc::trackedCalloc, alloc::trackedRealloc, alloc::trackedFree);
 
     // initialize SDL
     std::cout << "DEBUG - initialize SDL."  << std::endl;
@@ -76,7 +95,11 @@ bool SDLCommon::init(int sw, int sh, int tw, int th)
     if (!_pTextFont)
         std::cout << "Failed to load font: " << TTF_GetError() << std::endl;
     else
+    {
         _fontSizeY = TTF_FontLineSkip(_pTextFont);
+        if (!_glyphAtlas.build(_pTextFont))
+            std::cout << "WARNING - cannot build the glyph atlas: " << TTF_GetError() << std::endl;
+    }
 
     _frameStart = SDL_GetPerformanceCounter();
     _frameEnd = SDL_GetPerformanceCounter();
@@ -85,15 +108,23 @@ bool SDLCommon::init(int sw, int sh, int tw, int th)
     _cameraViewport = {0, 0, _screenWidth, _screenHeight};
     _zoomScale = 1.0f;
 
-    // set surfaces
-    _pTextureSurface = SDL_CreateRGBSurface(0, _textureWidth, _textureHeight, 32, 0, 0, 0, 0);
+    // set surfaces, in screen mode the canvas does not depend on the world size
+    _canvasWidth = (_renderMode == RenderMode::SCREEN) ? _screenWidth : _textureWidth;
+    _canvasHeight = (_renderMode == RenderMode::SCREEN) ? _screenHeight : _textureHeight;
+    _pTextureSurface = SDL_CreateRGBSurface(0, _canvasWidth, _canvasHeight, 32, 0, 0, 0, 0);
     _pWindowSurface = SDL_GetWindowSurface(_pWindow);
+    if (!_pTextureSurface)
+    {
+        std::cout << "Canvas cannot be created. SDL_Error :" << SDL_GetError() << std::endl;
+        return false;
+    }
 
     Uint32 backgroundColor = SDL_MapRGB(_pTextureSurface->format, 0, 0, 0);
     SDL_FillRect(_pTextureSurface, NULL, backgroundColor);
 
     _texturePixels = (Uint32*)_pTextureSurface->pixels;
-    memset(_texturePixels, 0, _textureWidth * _textureHeight * sizeof(Uint32));
+    memset(_texturePixels, 0, _canvasWidth * _canvasHeight * sizeof(Uint32));
+    updateCanvasTransform();
     
     std::cout << "DEBUG - finished init." << std::endl;
 
@@ -110,86 +141,405 @@ void SDLCommon::execute()
         _atomIsRunning = false;
     }
     
+    _cpuUsage.reset();
+    if (_bThreaded)
+        runThreadedLoop();
+    else
+        runLoop();
+    onUserStop();
+
+    std::cout << "DEBUG - " << _profiler.getFrameCount() << " frames drawn in " << _loopCount
+              << " loops, cpu usage " << _cpuUsage.getTotal() << "% over "
+              << _cpuUsage.getWallSeconds() << " s" << std::endl;
+
+    TRACE_EXPORT("trace.json");
+
+    if (!_profileFileName.empty())
+    {
+        if (_profiler.dump(_profileFileName))
+            std::cout << "DEBUG - frame profile written to " << _profileFileName << std::endl;
+        else
+            std::cout << "WARNING - cannot write frame profile to " << _profileFileName << std::endl;
+    }
+}
+
+// update and render on the main thread
+void SDLCommon::runLoop()
+{
     while(_atomIsRunning)
     {
+        // nothing to redraw, sleep until an event which is left in the queue for onUserUpdate
+        if (_bRedrawOnDemand && !_bDirty)
+        {
+            TRACE_SCOPE("idle");
+            SDL_WaitEventTimeout(NULL, _idleTimeout);
+        }
+
+        TRACE_SCOPE("frame");
+        alloc::Counts frameAllocs = alloc::current();
+        _cpuUsage.update();
+        _loopCount++;
+
         //Handle elapse time
         _frameEnd = SDL_GetPerformanceCounter();
         float frameTime = (_frameEnd - _frameStart) / (float)(SDL_GetPerformanceFrequency());
         _frameStart = _frameEnd;
-
-        // set background color
-        SDL_FillRect(_pTextureSurface, NULL, convertColorUint(color::black));
         
         // user defined game loop
-        onUserUpdate(frameTime); 
+        {
+            TRACE_SCOPE("update");
+            ScopedTimer t(_profiler, _phaseUpdate);
+            _polledTimestamp = 0;
+            onUserUpdate(frameTime); 
+        }
+
+        if (_bRedrawOnDemand && !_bDirty)
+            continue;
+        _bDirty = false;
+
+        // set background color
+        {
+            TRACE_SCOPE("clear");
+            ScopedTimer t(_profiler, _phaseClear);
+            SDL_FillRect(_pTextureSurface, NULL, convertColorUint(color::black));
+        }
         
         // user defined rendering
-        onUserRender();
-        
-        // Draw the visible portion of the canvas to the screen
-        SDL_Rect srcRect = _cameraViewport;
+        {
+            TRACE_SCOPE("render");
+            ScopedTimer t(_profiler, _phaseRender);
+            updateCanvasTransform(); // the camera may have moved in the update
+            _drawBlend = raster::Blend::COPY;
+            onUserRender();
+            resolveSplats();
+        }
+
+        Uint32 inputTimestamp = _inputTimestamp;
+        _inputTimestamp = 0;
+        presentFrame(_cameraViewport, inputTimestamp, frameAllocs);
+    }
+}
+
+// the main thread pumps the events and replays the frames recorded by the update thread
+void SDLCommon::runThreadedLoop()
+{
+    _updateThread = std::thread(&SDLCommon::updateLoop, this);
+
+    while(_atomIsRunning)
+    {
+        // handled by the update thread, dropped if it stalls for a long time
+        SDL_Event event;
+        while (SDL_PollEvent(&event) != 0)
+        {
+            if (!_eventQueue.push(event))
+                break;
+        }
+
+        if (!_drawLists.hasFresh())
+        {
+            TRACE_SCOPE("idle");
+            SDL_WaitEventTimeout(NULL, 1);
+            continue;
+        }
+
+        TRACE_SCOPE("frame");
+        alloc::Counts frameAllocs = alloc::current();
+        _cpuUsage.update();
+        _loopCount++;
+        _frameStart = SDL_GetPerformanceCounter();
+
+        const DrawList& list = _drawLists.take();
+        {
+            TRACE_SCOPE("clear");
+            ScopedTimer t(_profiler, _phaseClear);
+            SDL_FillRect(_pTextureSurface, NULL, convertColorUint(color::black));
+        }
+        {
+            TRACE_SCOPE("replay");
+            ScopedTimer t(_profiler, _phaseReplay);
+            replayDrawList(list);
+        }
+
+        // the following frames may carry the same input until the update thread sees it presented
+        Uint32 inputTimestamp = list.inputTimestamp;
+        if (inputTimestamp == _presentedInput.load(std::memory_order_relaxed))
+            inputTimestamp = 0;
+        presentFrame(list.cameraViewport, inputTimestamp, frameAllocs);
+        if (inputTimestamp)
+            _presentedInput.store(inputTimestamp, std::memory_order_relaxed);
+    }
+
+    _updateThread.join();
+}
+
+// fixed timestep loop of the update thread
+void SDLCommon::updateLoop()
+{
+    using clock = std::chrono::steady_clock;
+    const clock::duration step = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / _updateRate));
+    clock::time_point next = clock::now();
+    uint64_t update = 0;
+
+    while (_atomIsRunning)
+    {
+        {
+            TRACE_SCOPE("update");
+            ScopedTimer t(_profiler, _phaseUpdate);
+            _polledTimestamp = 0;
+            onUserUpdate(1.0f / _updateRate);
+        }
+        update++;
+
+        if (!_bRedrawOnDemand || _bDirty)
+        {
+            _bDirty = false;
+            recordFrame(update);
+        }
+
+        // restart the clock when late by several steps rather than catching up
+        next += step;
+        clock::time_point now = clock::now();
+        if (now > next + 4 * step)
+            next = now;
+        else
+            std::this_thread::sleep_until(next);
+    }
+}
+
+// record the draw calls of onUserRender and hand them to the main thread
+void SDLCommon::recordFrame(uint64_t update)
+{
+    TRACE_SCOPE("record");
+    ScopedTimer t(_profiler, _phaseRender);
+
+    // an input stays in the recorded frames until one of them is presented
+    if (_recordedInput && _presentedInput.load(std::memory_order_relaxed) == _recordedInput)
+        _recordedInput = 0;
+    if (!_recordedInput)
+        _recordedInput = _inputTimestamp;
+    _inputTimestamp = 0;
+
+    DrawList& list = _drawLists.back();
+    list.clear();
+    list.cameraViewport = _cameraViewport;
+    list.zoomScale = _zoomScale;
+    list.update = update;
+    list.inputTimestamp = _recordedInput;
+
+    _pRecording = &list;
+    onUserRender();
+    _pRecording = nullptr;
+
+    _drawLists.publish();
+}
+
+void SDLCommon::replayDrawList(const DrawList& list)
+{
+    updateCanvasTransform(list.cameraViewport, list.zoomScale);
+    _drawBlend = raster::Blend::COPY;
+
+    BeginBatch();
+    for (const auto& cmd : list.vCommands)
+    {
+        switch (cmd.type)
+        {
+            case DrawList::Type::LINE: DrawLine(cmd.a, cmd.b, cmd.c, cmd.d, cmd.color); break;
+            case DrawList::Type::RECT: DrawRect({cmd.a, cmd.b}, cmd.c, cmd.d, cmd.color); break;
+            case DrawList::Type::FILLED_RECT: DrawFilledRect({cmd.a, cmd.b}, cmd.c, cmd.d, cmd.color); break;
+            case DrawList::Type::CIRCLE: DrawCircle({cmd.a, cmd.b}, cmd.c, cmd.color); break;
+            case DrawList::Type::FILLED_CIRCLE: DrawFilledCircle({cmd.a, cmd.b}, cmd.c, cmd.color); break;
+            case DrawList::Type::TEXT: DrawText(&list.vText[cmd.textOffset], {cmd.a, cmd.b}, cmd.color); break;
+            case DrawList::Type::TEXT_PIXELS: DrawTextPixels(&list.vText[cmd.textOffset], {cmd.a, cmd.b}, cmd.color); break;
+            case DrawList::Type::SPRITE: DrawSprite(cmd.c, {cmd.a, cmd.b}); break;
+            case DrawList::Type::BLEND_MODE: setDrawBlendMode((SDL_BlendMode)cmd.a); break;
+        }
+    }
+    FlushBatch();
+    resolveSplats();
+}
+
+// blit the canvas and the texts, present and close the frame
+void SDLCommon::presentFrame(const SDL_Rect& viewport, Uint32 inputTimestamp, const alloc::Counts& frameAllocs)
+{
+    // Draw the visible portion of the canvas to the screen
+    {
+        TRACE_SCOPE("blit");
+        ScopedTimer t(_profiler, _phaseBlit);
         SDL_Rect dstRect = { 0, 0, _screenWidth, _screenHeight };
-        SDL_BlitScaled(_pTextureSurface, &srcRect, _pWindowSurface, &dstRect);
-        if (_pTextSurface != nullptr)
-            SDL_BlitSurface(_pTextSurface, NULL, _pWindowSurface, &dstRect);
+        if (_renderMode == RenderMode::SCREEN)
+        {
+            // already at the window resolution
+            SDL_BlitSurface(_pTextureSurface, NULL, _pWindowSurface, &dstRect);
+        }
+        else
+        {
+            SDL_Rect srcRect = viewport;
+            SDL_BlitScaled(_pTextureSurface, &srcRect, _pWindowSurface, &dstRect);
+        }
+    }
 
-        // Update window surface
+    if (_bShowProfiler)
+        drawProfilerOverlay();
+    drawHudTexts();
+
+    // Update window surface
+    {
+        TRACE_SCOPE("present");
         SDL_UpdateWindowSurface(_pWindow);
     }
-    onUserStop();
+
+    if (inputTimestamp)
+        _profiler.addSample(_phaseLatency, (double)(SDL_GetTicks() - inputTimestamp));
+
+    // the busy time of the frame, without the idle wait and the cap
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 frameEnd = SDL_GetPerformanceCounter();
+    _profiler.addSample(_phaseFrame, (frameEnd - _frameStart) * 1000.0 / frequency);
+    _profiler.addAllocations(_phaseFrame, frameAllocs, alloc::current());
+    _profiler.endFrame();
+    checkFrameAllocations();
+
+    if (_frameCap > 0)
+    {
+        TRACE_SCOPE("cap");
+        Uint64 capEnd = _frameStart + frequency / _frameCap;
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now < capEnd)
+            SDL_Delay((Uint32)((capEnd - now) * 1000 / frequency));
+    }
+}
+
+void SDLCommon::setThreadedUpdate(bool bThreaded, int updatesPerSecond)
+{
+    _bThreaded = bThreaded;
+    _updateRate = std::max(1, updatesPerSecond);
+    if (_bThreaded)
+        _phaseReplay = _profiler.addPhase("replay");
 }
 
-void SDLCommon::DrawText(const std::string str, Vec2<int> pos, SDL_Color color)
+bool SDLCommon::pollEvent(SDL_Event& event)
 {
-    SDL_Surface *textSurface;
+    bool bPolled = _bThreaded ? _eventQueue.pop(event) : SDL_PollEvent(&event) != 0;
+    if (bPolled)
+        _polledTimestamp = event.common.timestamp;
+    return bPolled;
+}
 
-    if(!(textSurface=TTF_RenderText_Blended(_pTextFont, str.c_str(), color))) 
+void SDLCommon::DrawText(const std::string& str, Vec2<int> pos, SDL_Color color)
+{
+    DrawText(str.c_str(), pos, color);
+}
+
+void SDLCommon::DrawText(const char* str, Vec2<int> pos, SDL_Color color)
+{
+    if (_pRecording)
     {
-        std::cout << "Unable to create text surface: " << TTF_GetError() << std::endl;
-    } 
-    else 
+        _pRecording->addText(DrawList::Type::TEXT, str, pos.x, pos.y, color);
+        return;
+    }
+
+    TRACE_FUNCTION();
+    ScopedTimer t(_profiler, _phaseText);
+    if (!_glyphAtlas.isBuilt()) return;
+
+    if (_hudCount == _vHudTexts.size())
+        _vHudTexts.emplace_back();
+    HudText& hud = _vHudTexts[_hudCount++];
+    hud.pos = pos;
+
+    // same text as the previous frame
+    if (hud.surface && hud.text == str &&
+        hud.color.r == color.r && hud.color.g == color.g && hud.color.b == color.b)
+        return;
+
+    hud.text = str; // reuses the capacity
+    hud.color = color;
+    hud.width = _glyphAtlas.measure(str);
+
+    // grow the surface by steps, so a changing number does not reallocate it
+    if (!hud.surface || hud.surface->w < hud.width)
     {
-        _pTextSurface = SDL_ConvertSurfaceFormat(textSurface, SDL_PIXELFORMAT_ARGB8888, 0);
-        _textDstRect = { pos.x, pos.y, textSurface->w, textSurface->h };
-        SDL_BlitSurface(_pTextSurface, NULL, _pWindowSurface, NULL);
+        SDL_FreeSurface(hud.surface);
+        hud.surface = createColorSurface(std::max(256, hud.width * 3 / 2), _glyphAtlas.getHeight());
+        if (!hud.surface) return;
+        SDL_SetSurfaceBlendMode(hud.surface, SDL_BLENDMODE_BLEND);
     }
-    
-    SDL_FreeSurface(textSurface);
+
+    SDL_FillRect(hud.surface, NULL, 0);
+    _glyphAtlas.compose(str, 0, 0, convertColorUint(color), hud.surface->format->Amask,
+                        (uint32_t*)hud.surface->pixels, hud.surface->pitch / 4,
+                        hud.surface->w, hud.surface->h);
 }
 
-void SDLCommon::DrawTextPixels(const std::string str, Vec2<int> pos, SDL_Color color)
+// blit the texts of the frame on the window
+void SDLCommon::drawHudTexts()
 {
-    SDL_Surface* textSurface = TTF_RenderText_Blended(_pTextFont, str.c_str(), color);
-    if (!textSurface) 
+    ScopedTimer t(_profiler, _phaseText);
+    for (size_t i = 0; i < _hudCount; i++)
     {
-        std::cerr << "Unable to render text surface! SDL_ttf Error: " << TTF_GetError() << std::endl;
-        return;
+        HudText& hud = _vHudTexts[i];
+        if (!hud.surface) continue;
+
+        SDL_Rect srcRect = {0, 0, hud.width, hud.surface->h};
+        SDL_Rect dstRect = {hud.pos.x, hud.pos.y, hud.width, hud.surface->h};
+        SDL_BlitSurface(hud.surface, &srcRect, _pWindowSurface, &dstRect);
     }
+    _hudCount = 0;
+}
 
-    // Ensure the surface is in the correct pixel format
-    _pTextSurface = SDL_ConvertSurfaceFormat(textSurface, SDL_PIXELFORMAT_ARGB8888, 0);
-    if (!_pTextSurface) 
+void SDLCommon::DrawTextPixels(const std::string& str, Vec2<int> pos, SDL_Color color)
+{
+    if (_pRecording)
     {
-        std::cerr << "Unable to convert text surface to correct format! SDL Error: " << SDL_GetError() << std::endl;
-        SDL_FreeSurface(textSurface);
+        _pRecording->addText(DrawList::Type::TEXT_PIXELS, str.c_str(), pos.x, pos.y, color);
         return;
     }
 
-    Uint32* textPixels = static_cast<Uint32*>(_pTextSurface->pixels);
-    for (int i = 0; i < _pTextSurface->w; ++i) 
+    TRACE_FUNCTION();
+    if (!_glyphAtlas.isBuilt()) return;
+
+    pos = worldToCanvas(pos.x, pos.y);
+    _glyphAtlas.blend(str.c_str(), pos.x, pos.y, convertColorUint(color),
+                      _texturePixels, _canvasWidth, _canvasWidth, _canvasHeight);
+}
+
+// world to canvas transformation, the identity in world mode
+void SDLCommon::updateCanvasTransform()
+{
+    updateCanvasTransform(_cameraViewport, _zoomScale);
+}
+
+void SDLCommon::updateCanvasTransform(const SDL_Rect& viewport, float zoomScale)
+{
+    _frameZoom = zoomScale;
+    if (_renderMode == RenderMode::SCREEN)
     {
-        for (int j = 0; j < _pTextSurface->h; ++j) 
-        {
-            Uint32 pixel = textPixels[j * _pTextSurface->w + i];
-            if ((pixel & 0xFF000000) != 0) // Check if pixel is not transparent
-                setPixel(_pTextSurface, pos.x + i, pos.y + j, pixel);
-        }
+        _canvasOrigin = {(float)viewport.x, (float)viewport.y};
+        _canvasScale = zoomScale;
+    }
+    else
+    {
+        _canvasOrigin = {0.0f, 0.0f};
+        _canvasScale = 1.0f;
     }
-    SDL_FreeSurface(textSurface);
 }
 
 // function to draw a line
 void SDLCommon::DrawLine(int x1, int y1, int x2, int y2, SDL_Color color)
+{
+    if (_pRecording)
+    {
+        _pRecording->add(DrawList::Type::LINE, x1, y1, x2, y2, color);
+        return;
+    }
+
+    Vec2<int> p1 = worldToCanvas(x1, y1);
+    Vec2<int> p2 = worldToCanvas(x2, y2);
+    rasterLine(p1.x, p1.y, p2.x, p2.y, color);
+}
+
+// line on the canvas
+void SDLCommon::rasterLine(int x1, int y1, int x2, int y2, SDL_Color color)
 {
     if (x1 == x2)
         drawVerticalLine(x1, y1, y2, color);
@@ -213,25 +563,52 @@ void SDLCommon::DrawLine(int x1, int y1, int x2, int y2, SDL_Color color)
 
 void SDLCommon::DrawRect(Vec2<int> pos, int w, int h, SDL_Color color)
 {
-    DrawLine(pos.x, pos.y, pos.x+w, pos.y, color);
-    DrawLine(pos.x, pos.y, pos.x, pos.y+h, color);
-    DrawLine(pos.x+w, pos.y, pos.x+w, pos.y+h, color);
-    DrawLine(pos.x, pos.y+h, pos.x+w, pos.y+h, color);
+    if (_pRecording)
+    {
+        _pRecording->add(DrawList::Type::RECT, pos.x, pos.y, w, h, color);
+        return;
+    }
+
+    TRACE_FUNCTION();
+
+    Vec2<int> p1 = worldToCanvas(pos.x, pos.y);
+    Vec2<int> p2 = worldToCanvas(pos.x + w, pos.y + h);
+
+    rasterLine(p1.x, p1.y, p2.x, p1.y, color);
+    rasterLine(p1.x, p1.y, p1.x, p2.y, color);
+    rasterLine(p2.x, p1.y, p2.x, p2.y, color);
+    rasterLine(p1.x, p2.y, p2.x, p2.y, color);
 }
 
 void SDLCommon::DrawFilledRect(Vec2<int> pos, int w, int h, SDL_Color color)
 {
-    int xStart = std::max(0, pos.x);
-    int xEnd = std::min(_textureWidth - 1, pos.x + w - 1);
-    int yStart = std::max(0, pos.y);
-    int yEnd = std::min(_textureHeight - 1, pos.y + h - 1);
+    if (_pRecording)
+    {
+        _pRecording->add(DrawList::Type::FILLED_RECT, pos.x, pos.y, w, h, color);
+        return;
+    }
 
-    for (int j = yStart; j <= yEnd; ++j) 
-        DrawLine(xStart, j, xEnd, j, color);
+    TRACE_FUNCTION();
+
+    Vec2<int> p1 = worldToCanvas(pos.x, pos.y);
+    Vec2<int> p2 = worldToCanvas(pos.x + w, pos.y + h);
+
+    rasterFilledRect(p1.x, p1.y, p2.x - 1, p2.y - 1, convertColorUint(color), _drawBlend, color.a);
 }
 
 void SDLCommon::DrawCircle(Vec2<int> pos, int r, SDL_Color color)
 {
+    if (_pRecording)
+    {
+        _pRecording->add(DrawList::Type::CIRCLE, pos.x, pos.y, r, 0, color);
+        return;
+    }
+
+    TRACE_FUNCTION();
+
+    pos = worldToCanvas(pos.x, pos.y);
+    r = worldToCanvas(r);
+
     int x = r - 1;
     int y = 0;
     int dx = 1;
@@ -265,6 +642,342 @@ void SDLCommon::DrawCircle(Vec2<int> pos, int r, SDL_Color color)
 }
 
 void SDLCommon::DrawFilledCircle(Vec2<int> pos, int r, SDL_Color color)
+{
+    if (_pRecording)
+    {
+        _pRecording->add(DrawList::Type::FILLED_CIRCLE, pos.x, pos.y, r, 0, color);
+        return;
+    }
+
+    TRACE_FUNCTION();
+
+    SmallObjects policy = _smallObjects.load(std::memory_order_relaxed);
+    if (policy != SmallObjects::DRAW)
+    {
+        float diameter = 2.0f * r * screenScale();
+        if (diameter < _minPixels.load(std::memory_order_relaxed))
+        {
+            if (policy == SmallObjects::SPLAT)
+                splat(pos, diameter, color);
+            return;
+        }
+    }
+
+    pos = worldToCanvas(pos.x, pos.y);
+    r = worldToCanvas(r);
+
+    rasterFilledCircle(pos.x, pos.y, r, convertColorUint(color), _drawBlend, color.a);
+}
+
+void SDLCommon::setDrawBlendMode(SDL_BlendMode mode)
+{
+    if (_pRecording)
+    {
+        _pRecording->add(DrawList::Type::BLEND_MODE, (int)mode, 0, 0, 0, {});
+        return;
+    }
+
+    switch (mode)
+    {
+        case SDL_BLENDMODE_BLEND: _drawBlend = raster::Blend::OVER; break;
+        case SDL_BLENDMODE_ADD: _drawBlend = raster::Blend::ADD; break;
+        default: _drawBlend = raster::Blend::COPY; break;
+    }
+}
+
+void SDLCommon::DrawSprite(int sprite, Vec2<int> pos)
+{
+    if (_pRecording)
+    {
+        _pRecording->add(DrawList::Type::SPRITE, pos.x, pos.y, sprite, 0, {});
+        return;
+    }
+
+    TRACE_FUNCTION();
+    if (!_spriteAtlas.isValid(sprite)) return;
+    const SpriteAtlas::View& v = _spriteAtlas.view(sprite);
+
+    pos = worldToCanvas(pos.x, pos.y);
+    int x0 = pos.x - v.w / 2;
+    int y0 = pos.y - v.h / 2;
+
+    // the rows and columns of the sprite inside the canvas
+    int sx0 = std::max(0, -x0);
+    int sx1 = std::min(v.w, _canvasWidth - x0);
+    int sy0 = std::max(0, -y0);
+    int sy1 = std::min(v.h, _canvasHeight - y0);
+    if (sx0 >= sx1 || sy0 >= sy1) return;
+
+    if (v.bOpaque)
+    {
+        for (int sy = sy0; sy < sy1; sy++)
+            memcpy(_texturePixels + (y0 + sy) * _canvasWidth + x0 + sx0, v.pixels + sy * v.pitch + sx0,
+                   (sx1 - sx0) * sizeof(Uint32));
+        return;
+    }
+
+    Uint32 alphaMask = _spriteAtlas.getAlphaMask();
+    Uint32 alphaTest = alphaMask & ~(alphaMask >> 1); // the high bit of the alpha
+    for (int sy = sy0; sy < sy1; sy++)
+    {
+        const Uint32* src = v.pixels + sy * v.pitch;
+        Uint32* dst = _texturePixels + (y0 + sy) * _canvasWidth + x0;
+        for (int sx = sx0; sx < sx1; sx++)
+        {
+            if (src[sx] & alphaTest)
+                dst[sx] = src[sx];
+        }
+    }
+}
+
+void SDLCommon::setSmallObjects(SmallObjects policy, float minPixels)
+{
+    _smallObjects = policy;
+    minPixels = std::max(0.0f, minPixels);
+    _minPixels = minPixels;
+    markDirty();
+    _tileCache.clear(); // the tiles of every level hold the small objects
+
+    const char* names[] = {"drawn", "skipped", "splatted"};
+    std::cout << "DEBUG - objects below " << minPixels << " pixels "
+              << names[(int)policy] << std::endl;
+}
+
+// window pixels per world unit, the recording thread only knows the camera
+float SDLCommon::screenScale() const
+{
+    if (_pRecording) return _zoomScale;
+    return (_renderMode == RenderMode::SCREEN) ? _canvasScale : _frameZoom;
+}
+
+float SDLCommon::getMinWorldSize() const
+{
+    if (_smallObjects != SmallObjects::SKIP) return 0.0f;
+    return _minPixels.load() / screenScale();
+}
+
+// add a small object to its pixel, the coverage is its area in pixels
+void SDLCommon::splat(Vec2<int> pos, float diameter, SDL_Color color)
+{
+    if (_renderMode == RenderMode::WORLD)
+    {
+        // the canvas is the world, too large to accumulate: one window pixel of its color
+        int side = std::max(1, (int)ceilf(1.0f / _frameZoom));
+        rasterFilledRect(pos.x, pos.y, pos.x + side - 1, pos.y + side - 1, convertColorUint(color));
+        return;
+    }
+
+    pos = worldToCanvas(pos.x, pos.y);
+    if (pos.x < 0 || pos.y < 0 || pos.x >= _canvasWidth || pos.y >= _canvasHeight) return;
+
+    size_t pixels = (size_t)_canvasWidth * _canvasHeight;
+    if (_vSplats.size() < pixels)
+        _vSplats.resize(pixels);
+
+    Uint32 index = pos.y * _canvasWidth + pos.x;
+    Splat& s = _vSplats[index];
+    if (s.weight == 0.0f)
+        _vSplatPixels.push_back(index);
+
+    float coverage = std::max(0.01f, PI * 0.25f * diameter * diameter);
+    s.r += color.r * coverage;
+    s.g += color.g * coverage;
+    s.b += color.b * coverage;
+    s.weight += coverage;
+}
+
+// blend the average color of each splatted pixel by its coverage, up to opaque
+void SDLCommon::resolveSplats()
+{
+    if (_vSplatPixels.empty()) return;
+
+    TRACE_FUNCTION();
+    for (Uint32 index : _vSplatPixels)
+    {
+        Splat& s = _vSplats[index];
+        float a = std::min(1.0f, s.weight);
+        SDL_Color dst = convertColorRGBA(_texturePixels[index]);
+        SDL_Color out = {
+            (Uint8)(s.r / s.weight * a + dst.r * (1.0f - a) + 0.5f),
+            (Uint8)(s.g / s.weight * a + dst.g * (1.0f - a) + 0.5f),
+            (Uint8)(s.b / s.weight * a + dst.b * (1.0f - a) + 0.5f),
+            255};
+        _texturePixels[index] = convertColorUint(out);
+        s = Splat();
+    }
+    _vSplatPixels.clear();
+}
+
+void SDLCommon::BeginBatch()
+{
+    if (_pRecording || !_bUseBatch) return;
+
+    _tileRenderer.begin(_canvasWidth, _canvasHeight);
+    _bBatching = true;
+}
+
+void SDLCommon::FlushBatch()
+{
+    if (_pRecording || !_bBatching) return;
+
+    TRACE_FUNCTION();
+    _tileRenderer.flush(_texturePixels, _canvasWidth);
+    _bBatching = false;
+}
+
+int SDLCommon::DrawCached()
+{
+    if (_renderMode != RenderMode::SCREEN || _bThreaded) return 0;
+
+    TRACE_FUNCTION();
+    FlushBatch(); // the tiles are rendered through the canvas
+
+    int level = TileCache::levelForScale(_canvasScale);
+    float tileWorld = TileCache::tileWorldSize(level);
+
+    // the tiles overlapping the viewport
+    int tx0 = (int)floorf(_canvasOrigin.x / tileWorld);
+    int ty0 = (int)floorf(_canvasOrigin.y / tileWorld);
+    int tx1 = (int)floorf((_canvasOrigin.x + _canvasWidth / _canvasScale) / tileWorld);
+    int ty1 = (int)floorf((_canvasOrigin.y + _canvasHeight / _canvasScale) / tileWorld);
+
+    int rendered = 0;
+    for (int ty = ty0; ty <= ty1; ty++)
+    {
+        for (int tx = tx0; tx <= tx1; tx++)
+        {
+            TileCache::Key key{level, tx, ty};
+            SDL_Surface* tile = _tileCache.find(key);
+            if (!tile)
+            {
+                tile = _tileCache.takeSpare();
+                if (!tile)
+                {
+                    // the format of the canvas, so the blit copies the pixels without converting them
+                    tile = SDL_CreateRGBSurfaceWithFormat(0, TileCache::TILE_SIZE, TileCache::TILE_SIZE, 32, _pTextureSurface->format->format);
+                    if (!tile) return rendered;
+                    SDL_SetSurfaceBlendMode(tile, SDL_BLENDMODE_NONE); // opaque copy
+                }
+                renderTile(key, tile);
+                _tileCache.insert(key, tile);
+                rendered++;
+            }
+
+            // the corners go through the canvas transform, so the neighbours share their edges
+            Vec2<int> p0 = worldToCanvas((int)(tx * tileWorld), (int)(ty * tileWorld));
+            Vec2<int> p1 = worldToCanvas((int)((tx + 1) * tileWorld), (int)((ty + 1) * tileWorld));
+            SDL_Rect dstRect = {p0.x, p0.y, p1.x - p0.x, p1.y - p0.y};
+            SDL_BlitScaled(tile, NULL, _pTextureSurface, &dstRect);
+        }
+    }
+
+    return rendered;
+}
+
+void SDLCommon::DrawCachedInfo(int phase, SDL_Color textColor)
+{
+    auto ticStart = std::chrono::system_clock::now();
+    int rendered = 0;
+    {
+        ScopedTimer t(_profiler, phase);
+        rendered = DrawCached();
+        _profiler.addItems(phase, rendered);
+    }
+    std::chrono::duration<double> ticDuration = std::chrono::system_clock::now() - ticStart;
+    const TileCache::Stats& stats = _tileCache.getStats();
+    std::string info = "TILE CACHE: " +
+                    std::to_string(rendered) + " rendered, " +
+                    std::to_string(stats.tiles) + " cached (" +
+                    std::to_string(stats.bytes >> 20) + " MB) Time: " +
+                    std::to_string(ticDuration.count()) + " s";
+    DrawText(info, {10, 10}, textColor);
+}
+
+// render a tile with the draw functions by pointing the canvas to it
+void SDLCommon::renderTile(const TileCache::Key& key, SDL_Surface* tile)
+{
+    TRACE_FUNCTION();
+    resolveSplats(); // the splats of the canvas, before the tile uses the buffer
+
+    Uint32* pixels = _texturePixels;
+    int width = _canvasWidth;
+    int height = _canvasHeight;
+    Vec2<float> origin = _canvasOrigin;
+    float scale = _canvasScale;
+
+    float tileWorld = TileCache::tileWorldSize(key.level);
+    _texturePixels = (Uint32*)tile->pixels;
+    _canvasWidth = TileCache::TILE_SIZE;
+    _canvasHeight = TileCache::TILE_SIZE;
+    _canvasOrigin = {key.tx * tileWorld, key.ty * tileWorld};
+    _canvasScale = TileCache::TILE_SIZE / tileWorld;
+
+    SDL_FillRect(tile, NULL, convertColorUint(color::black));
+    SDL_Rect world = {(int)_canvasOrigin.x, (int)_canvasOrigin.y, (int)tileWorld, (int)tileWorld};
+    onUserRenderTile(world);
+    FlushBatch();
+    resolveSplats();
+
+    _texturePixels = pixels;
+    _canvasWidth = width;
+    _canvasHeight = height;
+    _canvasOrigin = origin;
+    _canvasScale = scale;
+}
+
+void SDLCommon::InvalidateCache(const SDL_Rect& world)
+{
+    _tileCache.invalidate((float)world.x, (float)world.y, (float)(world.x + world.w), (float)(world.y + world.h));
+}
+
+// fill the canvas rectangle [x0, x1] x [y0, y1], one span per row
+void SDLCommon::rasterFilledRect(int x0, int y0, int x1, int y1, Uint32 color, raster::Blend blend, Uint8 alpha)
+{
+    if (_bBatching)
+    {
+        _tileRenderer.addRect(x0, y0, x1, y1, color, blend, alpha);
+        return;
+    }
+
+    // clip once against the canvas
+    x0 = std::max(0, x0);
+    x1 = std::min(_canvasWidth - 1, x1);
+    y0 = std::max(0, y0);
+    y1 = std::min(_canvasHeight - 1, y1);
+    if (x0 > x1) return;
+
+    for (int y = y0; y <= y1; y++)
+        raster::drawSpan(_texturePixels + y * _canvasWidth, x0, x1, color, blend, alpha);
+}
+
+// fill a disc on the canvas, each row inside the canvas is filled once
+void SDLCommon::rasterFilledCircle(int cx, int cy, int r, Uint32 color, raster::Blend blend, Uint8 alpha)
+{
+    if (_bBatching)
+    {
+        _tileRenderer.addCircle(cx, cy, r, color, blend, alpha);
+        return;
+    }
+
+    if (r < 0) return;
+    if (cx + r < 0 || cx - r >= _canvasWidth || cy + r < 0 || cy - r >= _canvasHeight) return;
+
+    int dyStart = std::max(-r, -cy);
+    int dyEnd = std::min(r, _canvasHeight - 1 - cy);
+
+    for (int dy = dyStart; dy <= dyEnd; dy++)
+    {
+        int hw = raster::circleHalfWidth(r, dy);
+        int x0 = std::max(0, cx - hw);
+        int x1 = std::min(_canvasWidth - 1, cx + hw);
+        if (x0 <= x1)
+            raster::drawSpan(_texturePixels + (cy + dy) * _canvasWidth, x0, x1, color, blend, alpha);
+    }
+}
+
+// line based filled circle replaced by rasterFilledCircle, kept as the
+// reference of the raster benchmark
+void SDLCommon::drawFilledCircleLines(Vec2<int> pos, int r, SDL_Color color)
 {
     int x = r;
     int y = 0;
@@ -273,10 +986,10 @@ void SDLCommon::DrawFilledCircle(Vec2<int> pos, int r, SDL_Color color)
     while (x >= y) 
     {
         // Draw horizontal lines between symmetrical points
-        DrawLine(pos.x - x, pos.y + y, pos.x + x, pos.y + y, color);
-        DrawLine(pos.x - x, pos.y - y, pos.x + x, pos.y - y, color);
-        DrawLine(pos.x - y, pos.y + x, pos.x + y, pos.y + x, color);
-        DrawLine(pos.x - y, pos.y - x, pos.x + y, pos.y - x, color);
+        rasterLine(pos.x - x, pos.y + y, pos.x + x, pos.y + y, color);
+        rasterLine(pos.x - x, pos.y - y, pos.x + x, pos.y - y, color);
+        rasterLine(pos.x - y, pos.y + x, pos.x + y, pos.y + x, color);
+        rasterLine(pos.x - y, pos.y - x, pos.x + y, pos.y - x, color);
 
         y++;
         if (err < 0) {
@@ -288,6 +1001,168 @@ void SDLCommon::DrawFilledCircle(Vec2<int> pos, int r, SDL_Color color)
     }
 }
 
+// line based filled rectangle replaced by rasterFilledRect, kept as the
+// reference of the raster benchmark
+void SDLCommon::drawFilledRectLines(Vec2<int> pos, int w, int h, SDL_Color color)
+{
+    int xStart = std::max(0, pos.x);
+    int xEnd = std::min(_canvasWidth - 1, pos.x + w - 1);
+    int yStart = std::max(0, pos.y);
+    int yEnd = std::min(_canvasHeight - 1, pos.y + h - 1);
+
+    for (int j = yStart; j <= yEnd; ++j) 
+        rasterLine(xStart, j, xEnd, j, color);
+}
+
+// microbenchmark of the filled primitives on the canvas, the span rasteriser
+// against the line based reference, in pixels per second
+void SDLCommon::benchmarkRaster(std::ostream& os)
+{
+    if (_bThreaded)
+    {
+        os << "raster benchmark not available with the threaded update" << std::endl;
+        return;
+    }
+
+    using clock = std::chrono::steady_clock;
+    const double targetPixels = 2.0e7; // pixels drawn per size and method
+
+    srand(42);
+    auto randomPos = [this]() { return Vec2<int>{rand() % _canvasWidth, rand() % _canvasHeight}; };
+
+    // the pixels of the primitives clipped on the canvas, same for both methods
+    auto circlePixels = [this](Vec2<int> pos, int r)
+    {
+        size_t n = 0;
+        for (int dy = std::max(-r, -pos.y); dy <= std::min(r, _canvasHeight - 1 - pos.y); dy++)
+        {
+            int hw = raster::circleHalfWidth(r, dy);
+            n += std::max(0, std::min(_canvasWidth - 1, pos.x + hw) - std::max(0, pos.x - hw) + 1);
+        }
+        return n;
+    };
+    auto rectPixels = [this](Vec2<int> pos, int w)
+    {
+        size_t nx = std::max(0, std::min(_canvasWidth, pos.x + w) - std::max(0, pos.x));
+        size_t ny = std::max(0, std::min(_canvasHeight, pos.y + w) - std::max(0, pos.y));
+        return nx * ny;
+    };
+
+    os << "raster benchmark on a " << _canvasWidth << "x" << _canvasHeight << " canvas (Mpixels/s)" << std::endl;
+    os << "  primitive      size      lines      spans    speedup" << std::endl;
+
+    for (int shape = 0; shape < 2; shape++)
+    {
+        for (int size : {2, 8, 32, 128, 512})
+        {
+            int n = std::max(100, (int)(targetPixels / (shape == 0 ? PI * size * size : (double)size * size)));
+            std::vector<Vec2<int>> vPos(n);
+            size_t pixels = 0;
+            for (auto& pos : vPos)
+            {
+                pos = randomPos();
+                pixels += (shape == 0) ? circlePixels(pos, size) : rectPixels(pos, size);
+            }
+
+            auto tic = clock::now();
+            for (const auto& pos : vPos)
+            {
+                if (shape == 0) drawFilledCircleLines(pos, size, color::red);
+                else drawFilledRectLines(pos, size, size, color::red);
+            }
+            std::chrono::duration<double> tLines = clock::now() - tic;
+
+            tic = clock::now();
+            Uint32 c = convertColorUint(color::green);
+            for (const auto& pos : vPos)
+            {
+                if (shape == 0) rasterFilledCircle(pos.x, pos.y, size, c);
+                else rasterFilledRect(pos.x, pos.y, pos.x + size - 1, pos.y + size - 1, c);
+            }
+            std::chrono::duration<double> tSpans = clock::now() - tic;
+
+            char line[128];
+            snprintf(line, sizeof(line), "  %-10s %8d %10.1f %10.1f %9.2fx",
+                     shape == 0 ? "circle" : "rect", size,
+                     pixels / tLines.count() * 1e-6, pixels / tSpans.count() * 1e-6,
+                     tLines.count() / tSpans.count());
+            os << line << std::endl;
+        }
+    }
+
+    // the same random circles drawn one by one and as a tile batch
+    os << "  circles      count  per-call(ms)  batch(ms)    speedup (" << _threadPool.getWorkerCount() + 1 << " threads)" << std::endl;
+    bool bUseBatch = _bUseBatch;
+    _bUseBatch = true;
+    for (int n : {1000, 10000, 100000})
+    {
+        std::vector<std::pair<Vec2<int>, int>> vCircles(n);
+        for (auto& c : vCircles)
+            c = {randomPos(), rand() % 40};
+
+        Uint32 c = convertColorUint(color::green);
+        auto tic = clock::now();
+        for (const auto& circle : vCircles)
+            rasterFilledCircle(circle.first.x, circle.first.y, circle.second, c);
+        std::chrono::duration<double, std::milli> tCalls = clock::now() - tic;
+
+        tic = clock::now();
+        BeginBatch();
+        for (const auto& circle : vCircles)
+            rasterFilledCircle(circle.first.x, circle.first.y, circle.second, c);
+        FlushBatch();
+        std::chrono::duration<double, std::milli> tBatch = clock::now() - tic;
+
+        char line[128];
+        snprintf(line, sizeof(line), "  %-10s %7d %13.2f %10.2f %9.2fx", "batch", n,
+                 tCalls.count(), tBatch.count(), tCalls.count() / tBatch.count());
+        os << line << std::endl;
+    }
+    _bUseBatch = bUseBatch;
+
+    // full canvas overlays of alpha 100, the scalar kernels against the vector ones
+    os << "  overlay    passes     scalar     " << raster::SIMD_NAME << "    speedup (Mpixels/s)" << std::endl;
+    {
+        int passes = std::max(1, (int)(targetPixels / ((double)_canvasWidth * _canvasHeight)));
+        double pixels = (double)passes * _canvasWidth * _canvasHeight;
+        Uint32 c = convertColorUint(color::teal);
+        const Uint8 alpha = 100;
+        const char* names[] = {"copy", "over", "add"};
+
+        for (raster::Blend blend : {raster::Blend::COPY, raster::Blend::OVER, raster::Blend::ADD})
+        {
+            auto tic = clock::now();
+            for (int pass = 0; pass < passes; pass++)
+            {
+                for (int y = 0; y < _canvasHeight; y++)
+                {
+                    Uint32* row = _texturePixels + y * _canvasWidth;
+                    if (blend == raster::Blend::COPY)
+                        for (int x = 0; x < _canvasWidth; x++) row[x] = c;
+                    else if (blend == raster::Blend::OVER)
+                        raster::blendSpanScalar(row, _canvasWidth, c, raster::alphaWeight(alpha));
+                    else
+                        raster::addSpanScalar(row, _canvasWidth, raster::premultiply(c, raster::alphaWeight(alpha)));
+                }
+            }
+            std::chrono::duration<double> tScalar = clock::now() - tic;
+
+            tic = clock::now();
+            for (int pass = 0; pass < passes; pass++)
+                rasterFilledRect(0, 0, _canvasWidth - 1, _canvasHeight - 1, c, blend, alpha);
+            std::chrono::duration<double> tVector = clock::now() - tic;
+
+            char line[128];
+            snprintf(line, sizeof(line), "  %-8s %8d %10.1f %10.1f %9.2fx", names[(int)blend], passes,
+                     pixels / tScalar.count() * 1e-6, pixels / tVector.count() * 1e-6,
+                     tScalar.count() / tVector.count());
+            os << line << std::endl;
+        }
+    }
+
+    SDL_FillRect(_pTextureSurface, NULL, convertColorUint(color::black));
+}
+
 Vec2<float> SDLCommon::TextureToWindow(Vec2<float>& texturePos) 
 {
     Vec2<float> windowPoint;
@@ -307,6 +1182,8 @@ Vec2<float> SDLCommon::WindowToTexture(Vec2<float>& windowPos)
 
 void SDLCommon::Pan(int dx, int dy)
 {
+    markDirty();
+
     // update camera
     _cameraViewport.x += dx / _zoomScale;
     _cameraViewport.y += dy / _zoomScale;
@@ -324,6 +1201,8 @@ void SDLCommon::Pan(int dx, int dy)
 
 void SDLCommon::Zoom(const float scale, float* cursorSize)
 {
+    markDirty();
+
     float potentialzoom = _zoomScale * scale;
  
     if (_screenWidth / potentialzoom <=  _textureWidth&& 
@@ -344,7 +1223,7 @@ void SDLCommon::Zoom(const float scale, float* cursorSize)
             *cursorSize = *cursorSize / (_textureWidth / _cameraViewport.w);
         _cameraViewport.w = static_cast<int>(_textureWidth);
         _cameraViewport.h = static_cast<int>(_textureHeight);
-        _zoomScale = _screenWidth / _textureWidth;
+        _zoomScale = (float)_screenWidth / _textureWidth;
     }
 }
 
@@ -385,15 +1264,15 @@ SDL_Color SDLCommon::convertColorRGBA(Uint32 color)
 // function to change indivitual pixel value at a position on texture
 void SDLCommon::setPixel(const int x, const int y, SDL_Color color)
 {
-    if((x >= 0) && (x < _textureWidth) && (y >= 0) && (y < _textureHeight))
-        _texturePixels[y * _textureWidth + x] = convertColorUint(color);
+    if((x >= 0) && (x < _canvasWidth) && (y >= 0) && (y < _canvasHeight))
+        raster::drawPixel(_texturePixels[y * _canvasWidth + x], convertColorUint(color), _drawBlend, color.a);
 }
 
 // overloaded function of setPixel
 void SDLCommon::setPixel(const int x, const int y, Uint32 color)
 {
-    if((x >= 0) && (x < _textureWidth) && (y >= 0) && (y < _textureHeight))
-        _texturePixels[y * _textureWidth + x] = color;
+    if((x >= 0) && (x < _canvasWidth) && (y >= 0) && (y < _canvasHeight))
+        _texturePixels[y * _canvasWidth + x] = color;
 }
 
 void SDLCommon::setPixel(SDL_Surface* surface, const int x, const int y, Uint32 color)
@@ -440,53 +1319,6 @@ SDL_Surface* SDLCommon::loadImageToSurface(const std::string filename, int& w, i
     return s;
 }
 
-SDL_PixelFormat* SDLCommon::_pSpriteFormat = nullptr;
-
-//function to load an image to pixel format
-std::vector<std::shared_ptr<Uint32[]>> SDLCommon::loadImageToPixels(const std::string filename, std::vector<SDL_Rect> rects)
-{
-    std::vector<std::shared_ptr<Uint32[]>> vecPixels;
-    Uint32* pixels = nullptr;
-
-    //Load image at specified path
-    int imgW, imgH; // dimension of the raw image
-    SDL_Surface* loadedSurface = loadImageToSurface(filename, imgW, imgH);
-
-    if (!loadedSurface)
-    {
-        std::cout << "ERR - surface not valid." << std::endl;
-    }
-    else
-    {
-        pixels = static_cast<Uint32*>(loadedSurface->pixels);
-    }
-    if(pixels == nullptr)
-    {
-        std::cout << "ERR - pixels poiter is not valid" << std::endl;
-    }
-
-    for (int i = 0; i<rects.size(); i++) // we loop through all sprites
-    {
-        size_t sizePixels = rects[i].w * rects[i].h;
-        std::shared_ptr<Uint32[]> subPixels(new Uint32[sizePixels], std::default_delete<Uint32[]>());
-
-        int l = 0;
-        for (int k=rects[i].y; k<rects[i].y+rects[i].h; k++)
-        {
-            SDL_memcpy(&subPixels.get()[l*rects[i].w], &pixels[k*imgW+rects[i].x], sizeof(Uint32)*rects[i].w);
-            l++;
-        }
-
-        vecPixels.push_back(subPixels);
-        
-    }
-
-    _pSpriteFormat = loadedSurface->format;
-    SDL_FreeSurface(loadedSurface);
-
-    return vecPixels;
-}
-
 // helper function to create a transparant surface
 SDL_Surface * SDLCommon::createColorSurface(int w, int h)
 {
@@ -514,23 +1346,155 @@ SDL_Surface * SDLCommon::createColorSurface(int w, int h)
 
 void SDLCommon::drawHorizontalLine(int y, int xStart, int xEnd, SDL_Color color) 
 {
-    if (y < 0 || y >= _textureWidth) return; // Ensure y is within bounds
+    if (y < 0 || y >= _canvasHeight) return; // Ensure y is within bounds
     xStart = std::max(0, xStart);
-    xEnd = std::min(_textureWidth - 1, xEnd);
-    
-    for (int x = xStart; x <= xEnd; ++x) {
-        _texturePixels[y * _textureWidth + x] = convertColorUint(color);
+    xEnd = std::min(_canvasWidth - 1, xEnd);
+    if (xStart > xEnd) return;
+
+    raster::drawSpan(_texturePixels + y * _canvasWidth, xStart, xEnd, convertColorUint(color), _drawBlend, color.a);
+}
+
+// redraw only the frames marked dirty, or every frame
+void SDLCommon::setRedrawOnDemand(bool bOnDemand)
+{
+    _bRedrawOnDemand = bOnDemand;
+    _bDirty = true;
+    std::cout << "DEBUG - redraw " << (bOnDemand ? "on demand" : "every frame") << std::endl;
+}
+
+// attach or detach the hardware counters to the profiler phases
+void SDLCommon::togglePerfCounters()
+{
+    // the counters count the calling thread only
+    if (_bThreaded)
+    {
+        std::cout << "WARNING - hardware counters not available with the threaded update" << std::endl;
+        return;
+    }
+
+    markDirty();
+    if (_profiler.getCounters())
+    {
+        _profiler.setCounters(nullptr);
+        return;
+    }
+
+    // the profiler keeps timing phases without counters if they are not permitted
+    if (_perfCounters.isOpen() || _perfCounters.open())
+    {
+        _profiler.setCounters(&_perfCounters);
+        _bShowProfiler = true;
+    }
+}
+
+void SDLCommon::setZeroAllocationCheck(int warmupFrames)
+{
+    if (!alloc::isEnabled())
+    {
+        std::cout << "WARNING - allocation check needs the alloc tracker (cmake -DENABLE_ALLOC_TRACKER=ON)." << std::endl;
+        return;
+    }
+    _allocCheckWarmup = warmupFrames;
+}
+
+// stop the loop if the last frame allocated after the warm-up
+void SDLCommon::checkFrameAllocations()
+{
+    if (_allocCheckWarmup < 0 || _profiler.getFrameCount() <= (size_t)_allocCheckWarmup)
+        return;
+
+    const FrameProfiler::PhaseCounters& frame = _profiler.getPhaseCounters(_phaseFrame);
+    if (frame.allocations == 0)
+        return;
+
+    std::cout << "ERROR - frame " << _profiler.getFrameCount() << " allocated " << frame.allocations
+              << " times (" << frame.allocatedBytes << " bytes):" << std::endl;
+    for (size_t i = 0; i < _profiler.getPhaseCount(); i++)
+    {
+        const FrameProfiler::PhaseCounters& phase = _profiler.getPhaseCounters((int)i);
+        if ((int)i != _phaseFrame && phase.allocations > 0)
+            std::cout << "    " << _profiler.getPhaseName((int)i) << ": " << phase.allocations
+                      << " allocs, " << phase.allocatedBytes << " bytes" << std::endl;
+    }
+
+    _bFailed = true;
+    _atomIsRunning = false;
+}
+
+// show min/avg/p99 of every phase on top of the window
+void SDLCommon::drawProfilerOverlay()
+{
+    if (!_glyphAtlas.isBuilt()) return;
+
+    char line[128];
+    int y = _fontSizeY + 10; // below the demo info
+
+    auto drawLine = [&](const char* str, SDL_Color color)
+    {
+        DrawText(str, {10, y}, color);
+        y += _fontSizeY;
+    };
+
+    snprintf(line, sizeof(line), "cpu %5.1f%%  %s  cap %d fps", _cpuUsage.getLast(),
+             _bRedrawOnDemand ? "on demand" : "every frame", _frameCap);
+    drawLine(line, color::white);
+
+    for (size_t i = 0; i < _profiler.getPhaseCount(); i++)
+    {
+        FrameProfiler::PhaseStats stats = _profiler.getStats((int)i);
+        if (stats.frames == 0) continue;
+
+        snprintf(line, sizeof(line), "%-8s min %6.2f avg %6.2f p99 %6.2f ms",
+                 _profiler.getPhaseName((int)i).c_str(), stats.min, stats.avg, stats.p99);
+        drawLine(line, color::yellow);
+    }
+
+    // heap allocations of the last frame
+    if (alloc::isEnabled())
+    {
+        for (size_t i = 0; i < _profiler.getPhaseCount(); i++)
+        {
+            const FrameProfiler::PhaseCounters& counters = _profiler.getPhaseCounters((int)i);
+            if (counters.allocations == 0) continue;
+
+            snprintf(line, sizeof(line), "%-8s %6llu allocs %10llu bytes",
+                     _profiler.getPhaseName((int)i).c_str(),
+                     (unsigned long long)counters.allocations,
+                     (unsigned long long)counters.allocatedBytes);
+            drawLine(line, color::orange);
+        }
+    }
+
+    if (!_profiler.getCounters()) return;
+
+    // hardware counters of the last frame, per object for the phases reporting objects
+    for (size_t i = 0; i < _profiler.getPhaseCount(); i++)
+    {
+        const FrameProfiler::PhaseCounters& counters = _profiler.getPhaseCounters((int)i);
+        const uint64_t* v = counters.values.v;
+        if (v[PerfCounters::CYCLES] == 0) continue;
+
+        double n = counters.items ? (double)counters.items : 1.0;
+        snprintf(line, sizeof(line), "%-8s IPC %4.2f L1 %6.2f LLC %6.2f br %6.2f %s",
+                 _profiler.getPhaseName((int)i).c_str(),
+                 (double)v[PerfCounters::INSTRUCTIONS] / v[PerfCounters::CYCLES],
+                 v[PerfCounters::L1D_MISSES] / n,
+                 v[PerfCounters::LLC_MISSES] / n,
+                 v[PerfCounters::BRANCH_MISSES] / n,
+                 counters.items ? "/obj" : "");
+        drawLine(line, color::cyan);
     }
 }
 
 void SDLCommon::drawVerticalLine(int x, int yStart, int yEnd, SDL_Color color) 
 {
     // draw a vertical line by setting the pixels
-    if (x < 0 || x >= _textureWidth) return; // Ensure x is within bounds
+    if (x < 0 || x >= _canvasWidth) return; // Ensure x is within bounds
     yStart = std::max(0, yStart);
-    yEnd = std::min(_textureHeight - 1, yEnd);
+    yEnd = std::min(_canvasHeight - 1, yEnd);
 
+    Uint32 c = convertColorUint(color);
     for (int y = yStart; y <= yEnd; ++y) {
-        _texturePixels[y * _textureWidth + x] = convertColorUint(color);
+        raster::drawPixel(_texturePixels[y * _canvasWidth + x], c, _drawBlend, color.a);
     }
 }
\ No newline at end of file
@@ -8,11 +8,29 @@
 #include <math.h>
 #include <fstream>
 #include <algorithm>
+#include <thread>
 
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_ttf.h"
 #include "SDL2/SDL_image.h"
 
+#include "Profiler.h"
+#include "PerfCounters.h"
+#include "AllocTracker.h"
+#include "ThreadPool.h"
+#include "Raster.h"
+#include "TileRenderer.h"
+#include "TileCache.h"
+#include "GlyphAtlas.h"
+#include "SpriteAtlas.h"
+#include "EntityStore.h"
+#include "SpatialOrder.h"
+#include "DrawList.h"
+#include "TripleBuffer.h"
+#include "SpscQueue.h"
+#include "EpochReclaimer.h"
+#include "Trace.h"
+
 const float PI = 3.1415926;
 
 
@@ -59,6 +77,23 @@ namespace color
 }
 
 
+// where the draw functions rasterise
+enum class RenderMode
+{
+    WORLD = 0, // into a canvas of the size of the world, the viewport is scaled to the window
+    SCREEN, // through the camera into a canvas of the size of the window
+};
+
+
+// what the filled circles smaller than a few pixels on the screen become
+enum class SmallObjects
+{
+    DRAW = 0, // rasterised as the others
+    SKIP, // not drawn
+    SPLAT, // accumulated into their pixel, weighted by their coverage
+};
+
+
 // base class to handle graphics using sdl
 class SDLCommon
 {    
@@ -68,16 +103,35 @@ class SDLCommon
         virtual void onUserRender() = 0;
         virtual void onUserStop() {};
 
+        // draw the static scene inside the world rectangle, for the tile cache
+        virtual void onUserRenderTile(const SDL_Rect& world) {};
+
         void execute();
 
-        void DrawText(const std::string str, Vec2<int> pos, SDL_Color color={0, 0, 0, 255});
-        void DrawTextPixels(const std::string str, Vec2<int> pos, SDL_Color color);
+        // the draw functions take world positions and sizes, except the text which is on the window.
+        // The texts are composed from the glyph atlas and drawn over the frame, a text
+        // unchanged since the previous frame is not composed again.
+        void DrawText(const std::string& str, Vec2<int> pos, SDL_Color color={0, 0, 0, 255});
+        void DrawText(const char* str, Vec2<int> pos, SDL_Color color={0, 0, 0, 255});
+        // text blended into the canvas at a world position, not scaled
+        void DrawTextPixels(const std::string& str, Vec2<int> pos, SDL_Color color);
         void DrawLine(int x1, int y1, int x2, int y2, SDL_Color color);
         void DrawRect(Vec2<int> pos, int w, int h, SDL_Color color={0, 0, 0, 255});
         void DrawFilledRect(Vec2<int> pos, int w, int h, SDL_Color color={0, 0, 0, 255});
         void DrawCircle(Vec2<int> pos, int r, SDL_Color color={0, 0, 0, 255});
         void DrawFilledCircle(Vec2<int> pos, int r, SDL_Color color={0, 0, 0, 255});
+        // sprite of the atlas centred at a world position, not scaled. The opaque sprites
+        // are copied by rows, the others keep their pixels of alpha >= 128.
+        void DrawSprite(int sprite, Vec2<int> pos);
+        // to fill in onUserInit, the threaded update replays the sprites by index
+        inline SpriteAtlas& getSpriteAtlas() { return _spriteAtlas; };
 
+        // blending of the draw functions with the alpha of their color, as for an SDL renderer:
+        // SDL_BLENDMODE_NONE overwrites the pixels, BLEND is source over and ADD adds the
+        // color weighted by its alpha. Reset to NONE at the start of each frame.
+        void setDrawBlendMode(SDL_BlendMode mode);
+
+        // pixel positions on the canvas, the SDL_Color one is blended with the draw blend mode
         void setPixel(const int x, const int y, SDL_Color color);
         void setPixel(const int x, const int y, Uint32 color);
         void setPixel(SDL_Surface* surface, const int x, const int y, Uint32 color);
@@ -85,6 +139,43 @@ class SDLCommon
         inline Vec2<int> getScreenSize() const { return {_screenWidth, _screenHeight}; };
         inline Vec2<int> getTexttureSize() const { return {_textureWidth, _textureHeight}; };
         inline SDL_Rect getCameraViewport() const { return _cameraViewport; };
+        inline RenderMode getRenderMode() const { return _renderMode; };
+
+        // batch of filled circles/rects rasterised by tiles in parallel at FlushBatch().
+        // Without the batch mode (toggleBatch), they are drawn immediately.
+        // The other primitives are always drawn immediately.
+        void BeginBatch();
+        void FlushBatch();
+        inline void toggleBatch() { _bUseBatch = !_bUseBatch; markDirty(); };
+        inline bool isBatchEnabled() const { return _bUseBatch; };
+
+        // draw the viewport from the cached world tiles (SCREEN mode only), the
+        // missing tiles are rendered with onUserRenderTile at the mip level of the zoom.
+        // Returns the number of tiles rendered.
+        int DrawCached();
+        // DrawCached timed in the phase, with the tiles rendered and the cache size in the info line
+        void DrawCachedInfo(int phase, SDL_Color textColor);
+        // drop the cached tiles overlapping a changed world rectangle
+        void InvalidateCache(const SDL_Rect& world);
+        inline void toggleTileCache() { _bUseTileCache = !_bUseTileCache; markDirty(); };
+        inline bool isTileCacheEnabled() const { return _bUseTileCache && _renderMode == RenderMode::SCREEN && !_bThreaded; };
+        inline TileCache& getTileCache() { return _tileCache; };
+
+        // the work-stealing pool of the batched raster, shared with the demos
+        // for their parallel builds and traversals (see TaskGroup)
+        inline ThreadPool& getThreadPool() { return _threadPool; };
+
+        // policy of the filled circles below minPixels across on the screen. The splats of
+        // a frame are resolved after the user rendering, over the larger objects.
+        void setSmallObjects(SmallObjects policy, float minPixels = 1.0f);
+        inline void cycleSmallObjects() { setSmallObjects((SmallObjects)(((int)_smallObjects.load() + 1) % 3), _minPixels.load()); };
+        inline SmallObjects getSmallObjects() const { return _smallObjects; };
+        // world size below which the objects are skipped at the current zoom, for the
+        // queries pruning by object size. 0 unless SKIP, the splats need the small objects.
+        float getMinWorldSize() const;
+
+        // compare the raster paths of the filled primitives, see App.cpp
+        void benchmarkRaster(std::ostream& os);
 
         void Pan(int dx, int dy);
         void Zoom(const float scale, float* cursorSize=nullptr);
@@ -93,14 +184,47 @@ class SDLCommon
 
         Vec2<float> getMousePosOnRender();
 
+        // redraw only the frames marked dirty, otherwise the loop sleeps in
+        // SDL_WaitEventTimeout. Pan, Zoom and the toggles mark the frame dirty,
+        // the demos mark it when their data changes.
+        void setRedrawOnDemand(bool bOnDemand);
+        inline void toggleRedrawOnDemand() { setRedrawOnDemand(!_bRedrawOnDemand); };
+        inline void markDirty()
+        {
+            _bDirty = true;
+            if (!_inputTimestamp) _inputTimestamp = _polledTimestamp; // for the input latency
+        };
+        // maximum frames per second, 0 for no cap
+        inline void setFrameCap(int fps) { _frameCap = std::max(0, fps); };
+
+        // run onUserUpdate and onUserRender at a fixed rate on an update thread. The
+        // draw calls of onUserRender are recorded with the camera, the main thread
+        // replays the latest recording, presents it and pumps the events for pollEvent.
+        // To set before execute(), the tile cache and the F3/F4 tools are not available.
+        void setThreadedUpdate(bool bThreaded, int updatesPerSecond = 60);
+        inline bool isThreaded() const { return _bThreaded; };
+
+        // next input event for onUserUpdate, in the threaded mode from the events
+        // pumped by the main thread
+        bool pollEvent(SDL_Event& event);
+
+        // profiling of the frame phases, demos can add their own phases
+        inline FrameProfiler& getProfiler() { return _profiler; };
+        inline void toggleProfilerOverlay() { _bShowProfiler = !_bShowProfiler; markDirty(); };
+        void togglePerfCounters();
+
+        // stop with a failure if a frame allocates on the heap after the warm-up
+        // frames (needs the alloc tracker, see AllocTracker.h)
+        void setZeroAllocationCheck(int warmupFrames);
+        inline bool hasFailed() const { return _bFailed; };
+
     public:
         SDLCommon();
         ~SDLCommon();
 
-        bool init(int w, int h, int px, int py);
+        bool init(int w, int h, int px, int py, RenderMode mode=RenderMode::WORLD);
 
         static SDL_Surface* loadImageToSurface(const std::string filename, int& w, int& h);
-        static std::vector<std::shared_ptr<Uint32[]>> loadImageToPixels(const std::string filename, std::vector<SDL_Rect> rects);
         
     protected:
 
@@ -112,8 +236,6 @@ class SDLCommon
         SDL_Surface *_pScreenSurface = nullptr;
         Uint32 *_backgroundPixels = nullptr;
         SDL_Texture *_pTextTexture = nullptr;
-        SDL_Rect _textDstRect;
-        SDL_Surface *_pTextSurface = nullptr;
         SDL_Event _event;
 
         SDL_Surface* _pTextureSurface = nullptr;
@@ -128,6 +250,18 @@ class SDLCommon
         SDL_PixelFormat* _format;
 
         // for text
+        struct HudText
+        {
+            std::string text;
+            SDL_Color color;
+            Vec2<int> pos;
+            SDL_Surface* surface = nullptr; // the composed text, kept while it does not change
+            int width = 0;
+        };
+        GlyphAtlas _glyphAtlas;
+        std::vector<HudText> _vHudTexts; // one per DrawText call of the frame, in the order of the calls
+        size_t _hudCount = 0; // texts drawn in the current frame
+        SpriteAtlas _spriteAtlas;
         std::vector<std::string> _vecTexts;
         std::vector<SDL_Rect> _vecRect;
         int _textSize; // for showing
@@ -136,8 +270,14 @@ class SDLCommon
         int _screenWidth;
         int _pixelSizeX;
         int _pixelSizeY;
-        int _textureHeight;
+        int _textureHeight; // size of the world
         int _textureWidth;
+        RenderMode _renderMode = RenderMode::WORLD;
+        int _canvasWidth; // size of the canvas _pTextureSurface
+        int _canvasHeight;
+        Vec2<float> _canvasOrigin; // world position of the canvas pixel (0, 0)
+        float _canvasScale = 1.0f; // canvas pixels per world unit
+        float _frameZoom = 1.0f; // window pixels per world unit of the frame drawn
         const char* _fontFileName = "playfair.ttf";
         std::string _appName;
         Uint32 *_texturePixels;
@@ -148,11 +288,101 @@ class SDLCommon
         float _zoomScale;
         Vec2<int> _cursorPos;
 
-        static SDL_PixelFormat* _pSpriteFormat;
+        // frame profiler
+        FrameProfiler _profiler;
+        std::atomic<bool> _bShowProfiler{false};
+        std::string _profileFileName = "frame_profile.txt"; // dumped on exit, empty to disable
+        int _phaseFrame;
+        int _phaseClear;
+        int _phaseUpdate;
+        int _phaseRender;
+        int _phaseText;
+        int _phaseBlit;
+        PerfCounters _perfCounters; // hardware counters, opened on demand
+        CpuUsage _cpuUsage;
+        size_t _loopCount = 0; // iterations of the main loop, drawn or not
+
+        // redraw on demand
+        std::atomic<bool> _bRedrawOnDemand{false}; // threaded, toggled by the update thread, drawn by the main one
+        bool _bDirty = true;
+        int _frameCap = 0;
+        int _idleTimeout = 1000; // ms, the loop wakes up at least this often
+
+        // threaded update
+        bool _bThreaded = false;
+        int _updateRate = 60; // updates per second
+        std::thread _updateThread;
+        TripleBuffer<DrawList> _drawLists; // recorded by the update thread, replayed by the main thread
+        SpscQueue<SDL_Event, 1024> _eventQueue; // pumped by the main thread
+        inline static thread_local DrawList* _pRecording = nullptr; // the draw calls of this thread are recorded
+        int _phaseReplay = -1;
+
+        // input latency, from the SDL timestamp of an input which changed the frame to its present
+        int _phaseLatency;
+        Uint32 _polledTimestamp = 0; // the last event polled in this update
+        Uint32 _inputTimestamp = 0; // the oldest input since the last frame
+        Uint32 _recordedInput = 0; // threaded, the oldest input recorded and not presented yet
+        std::atomic<Uint32> _presentedInput{0}; // threaded, the input of the last presented frame
+
+        // parallel rasterisation, builds and traversals
+        ThreadPool _threadPool;
+        TileRenderer _tileRenderer{_threadPool};
+        std::atomic<bool> _bUseBatch{false};
+        bool _bBatching = false; // between BeginBatch and FlushBatch
+
+        // cache of the static scene
+        TileCache _tileCache;
+        std::atomic<bool> _bUseTileCache{false};
+
+        // small objects
+        struct Splat
+        {
+            float r = 0.0f, g = 0.0f, b = 0.0f; // colors weighted by the coverage
+            float weight = 0.0f; // sum of the coverages
+        };
+        std::atomic<SmallObjects> _smallObjects{SmallObjects::DRAW};
+        std::atomic<float> _minPixels{1.0f}; // set by the update thread, read by splat() on the main one
+        std::vector<Splat> _vSplats; // per canvas pixel
+        std::vector<Uint32> _vSplatPixels; // the touched ones in this frame
+
+        raster::Blend _drawBlend = raster::Blend::COPY; // of the draw functions
+
+        int _allocCheckWarmup = -1; // no check if negative
+        bool _bFailed = false;
+
         inline static std::atomic<bool> _atomIsRunning; // variable to control global game loop
 
 
         SDL_Surface * createColorSurface(int w, int h);
+        void updateCanvasTransform();
+        void updateCanvasTransform(const SDL_Rect& viewport, float zoomScale);
+        void runLoop();
+        void runThreadedLoop();
+        void updateLoop();
+        void recordFrame(uint64_t update);
+        void replayDrawList(const DrawList& list);
+        void presentFrame(const SDL_Rect& viewport, Uint32 inputTimestamp, const alloc::Counts& frameAllocs);
+        inline Vec2<int> worldToCanvas(int x, int y) const
+        {
+            return {(int)floorf((x - _canvasOrigin.x) * _canvasScale), (int)floorf((y - _canvasOrigin.y) * _canvasScale)};
+        };
+        inline int worldToCanvas(int length) const { return (int)(length * _canvasScale + 0.5f); };
+
+        float screenScale() const;
+        void splat(Vec2<int> pos, float diameter, SDL_Color color);
+        void resolveSplats();
+
+        void rasterLine(int x1, int y1, int x2, int y2, SDL_Color color);
+        void rasterFilledRect(int x0, int y0, int x1, int y1, Uint32 color,
+                              raster::Blend blend = raster::Blend::COPY, Uint8 alpha = 255);
+        void rasterFilledCircle(int cx, int cy, int r, Uint32 color,
+                                raster::Blend blend = raster::Blend::COPY, Uint8 alpha = 255);
+        void drawFilledCircleLines(Vec2<int> pos, int r, SDL_Color color);
+        void drawFilledRectLines(Vec2<int> pos, int w, int h, SDL_Color color);
         void drawHorizontalLine(int y, int xStart, int xEnd, SDL_Color color);
         void drawVerticalLine(int x, int yStart, int yEnd, SDL_Color color);
+        void renderTile(const TileCache::Key& key, SDL_Surface* tile);
+        void drawProfilerOverlay();
+        void drawHudTexts();
+        void checkFrameAllocations();
 };
\ No newline at end of file
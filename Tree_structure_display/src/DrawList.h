@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "SDL2/SDL.h"
+
+
+// draw calls of a frame recorded with their world positions, to be replayed
+// on another thread, with the camera they were recorded for. The vectors
+// keep their capacity, so a steady frame records without allocation.
+struct DrawList
+{
+    enum class Type : uint8_t
+    {
+        LINE = 0, // x1, y1, x2, y2
+        RECT, // x, y, w, h
+        FILLED_RECT,
+        CIRCLE, // x, y, r
+        FILLED_CIRCLE,
+        TEXT, // x, y on the window, text
+        TEXT_PIXELS, // x, y in the world, text
+        SPRITE, // x, y in the world, sprite index
+        BLEND_MODE, // SDL_BlendMode
+    };
+
+    struct Command
+    {
+        Type type;
+        SDL_Color color;
+        int a, b, c, d;
+        uint32_t textOffset; // in vText, null terminated
+    };
+
+    std::vector<Command> vCommands;
+    std::vector<char> vText;
+
+    // state of the update when the frame was recorded
+    SDL_Rect cameraViewport;
+    float zoomScale = 1.0f;
+    uint64_t update = 0; // index of the update step
+    Uint32 inputTimestamp = 0; // SDL ticks of the oldest input shown in this frame, 0 if none
+
+    void clear()
+    {
+        vCommands.clear();
+        vText.clear();
+        inputTimestamp = 0;
+    };
+
+    void add(Type type, int a, int b, int c, int d, SDL_Color color)
+    {
+        vCommands.push_back({type, color, a, b, c, d, 0});
+    };
+
+    void addText(Type type, const char* str, int x, int y, SDL_Color color)
+    {
+        uint32_t offset = (uint32_t)vText.size();
+        vText.insert(vText.end(), str, str + strlen(str) + 1);
+        vCommands.push_back({type, color, x, y, 0, 0, offset});
+    };
+};
@@ -0,0 +1,59 @@
+#include "EntityStore.h"
+
+EntityStore::Id EntityStore::add(float x, float y, float r, SDL_Color color, float velX, float velY)
+{
+    _vX.push_back(x);
+    _vY.push_back(y);
+    _vR.push_back(r);
+    _vVelX.push_back(velX);
+    _vVelY.push_back(velY);
+    _vColor.push_back(color);
+    return (Id)(_vX.size() - 1);
+}
+
+void EntityStore::reserve(size_t n)
+{
+    _vX.reserve(n);
+    _vY.reserve(n);
+    _vR.reserve(n);
+    _vVelX.reserve(n);
+    _vVelY.reserve(n);
+    _vColor.reserve(n);
+}
+
+void EntityStore::clear()
+{
+    _vX.clear();
+    _vY.clear();
+    _vR.clear();
+    _vVelX.clear();
+    _vVelY.clear();
+    _vColor.clear();
+}
+
+// new column of the values in the given order
+template <class T>
+static void permute(std::vector<T>& column, const std::vector<EntityStore::Id>& order)
+{
+    std::vector<T> sorted(order.size());
+    for (size_t k = 0; k < order.size(); k++)
+        sorted[k] = column[order[k]];
+    column.swap(sorted);
+}
+
+void EntityStore::reorder(const std::vector<Id>& order)
+{
+    if (order.size() != size()) return;
+    permute(_vX, order);
+    permute(_vY, order);
+    permute(_vR, order);
+    permute(_vVelX, order);
+    permute(_vVelY, order);
+    permute(_vColor, order);
+}
+
+size_t EntityStore::memoryBytes() const
+{
+    return (_vX.capacity() + _vY.capacity() + _vR.capacity() + _vVelX.capacity() + _vVelY.capacity()) * sizeof(float) +
+           _vColor.capacity() * sizeof(SDL_Color);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "SDL2/SDL.h"
+
+
+// objects of a scene as a structure of arrays, addressed by 32 bits ids.
+// The indices only keep the ids with the bounds they test, the other
+// attributes are read from here, so an edit is seen by all of them.
+// The ids are the positions in the columns and stay valid until clear().
+class EntityStore
+{
+    public:
+        using Id = uint32_t;
+
+        Id add(float x, float y, float r, SDL_Color color, float velX = 0.0f, float velY = 0.0f);
+        void reserve(size_t n);
+        void clear();
+        inline size_t size() const { return _vX.size(); };
+
+        // move the entity order[k] to the id k, e.g. along a space filling curve
+        // (see SpatialOrder.h). The ids change, the indices must be rebuilt.
+        void reorder(const std::vector<Id>& order);
+
+        inline float getX(Id id) const { return _vX[id]; };
+        inline float getY(Id id) const { return _vY[id]; };
+        inline float getRadius(Id id) const { return _vR[id]; };
+        inline float getVelX(Id id) const { return _vVelX[id]; };
+        inline float getVelY(Id id) const { return _vVelY[id]; };
+        inline SDL_Color getColor(Id id) const { return _vColor[id]; };
+
+        // the indices holding the entity are not updated
+        inline void setPosition(Id id, float x, float y) { _vX[id] = x; _vY[id] = y; };
+        inline void setVelocity(Id id, float vx, float vy) { _vVelX[id] = vx; _vVelY[id] = vy; };
+        inline void setRadius(Id id, float r) { _vR[id] = r; };
+        inline void setColor(Id id, SDL_Color color) { _vColor[id] = color; };
+
+        // the columns, for the passes over all entities
+        inline const float* getXs() const { return _vX.data(); };
+        inline const float* getYs() const { return _vY.data(); };
+        inline const float* getRadii() const { return _vR.data(); };
+
+        // bytes of the reserved columns
+        size_t memoryBytes() const;
+
+    private:
+        std::vector<float> _vX;
+        std::vector<float> _vY;
+        std::vector<float> _vR;
+        std::vector<float> _vVelX;
+        std::vector<float> _vVelY;
+        std::vector<SDL_Color> _vColor; // 4 bytes, rgba
+};
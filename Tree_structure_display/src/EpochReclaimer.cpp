@@ -0,0 +1,126 @@
+#include "EpochReclaimer.h"
+
+#include <functional>
+#include <thread>
+
+// the slots held by the calling thread, with the depth of its guards
+namespace
+{
+    struct Held
+    {
+        const EpochReclaimer* reclaimer;
+        size_t slot;
+        size_t depth;
+    };
+    thread_local Held tHeld[EpochReclaimer::HELD_MAX];
+    thread_local size_t tHeldCount = 0;
+
+    Held* findHeld(const EpochReclaimer* reclaimer)
+    {
+        for (size_t i = 0; i < tHeldCount; i++)
+        {
+            if (tHeld[i].reclaimer == reclaimer) return &tHeld[i];
+        }
+        return nullptr;
+    }
+}
+
+EpochReclaimer::~EpochReclaimer()
+{
+    for (const auto& retired : _vRetired)
+        retired.deleter(retired.p);
+}
+
+size_t EpochReclaimer::enter()
+{
+    // a nested guard keeps the slot and the epoch of the outermost one
+    if (Held* held = findHeld(this))
+    {
+        held->depth++;
+        return held->slot;
+    }
+
+    // the threads start at different slots so they rarely compete for one
+    size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % SLOTS;
+    while (true)
+    {
+        for (size_t i = 0; i < SLOTS; i++)
+        {
+            Slot& slot = _vSlots[(start + i) % SLOTS];
+            uint64_t free = 0;
+            // the epoch may be old by the time it is announced: the reader only keeps
+            // more memory alive, what was deleted meanwhile was unlinked before it reads
+            if (slot.epoch.load(std::memory_order_relaxed) == 0 &&
+                slot.epoch.compare_exchange_strong(free, _epoch.load()))
+            {
+                if (tHeldCount < HELD_MAX)
+                    tHeld[tHeldCount++] = {this, (start + i) % SLOTS, 1};
+                return (start + i) % SLOTS;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void EpochReclaimer::leave(size_t slot)
+{
+    if (Held* held = findHeld(this))
+    {
+        if (--held->depth > 0) return;
+        *held = tHeld[--tHeldCount];
+    }
+
+    _vSlots[slot].epoch.store(0, std::memory_order_release);
+}
+
+void EpochReclaimer::retire(void* p, void (*deleter)(void*))
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _vRetired.push_back({p, deleter, _epoch.load()});
+    if (++_retiredSinceCollect >= COLLECT_PERIOD)
+        collectLocked();
+}
+
+size_t EpochReclaimer::collect()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return collectLocked();
+}
+
+size_t EpochReclaimer::collectLocked()
+{
+    _retiredSinceCollect = 0;
+
+    // the epoch only moves when every reader announced it: after two moves, the
+    // readers left all entered after the memory of the first epoch was unlinked
+    uint64_t epoch = _epoch.load();
+    bool bAllIn = true;
+    for (const auto& slot : _vSlots)
+    {
+        uint64_t e = slot.epoch.load();
+        bAllIn &= (e == 0 || e == epoch);
+    }
+    if (bAllIn)
+        _epoch.store(++epoch);
+
+    size_t deleted = 0;
+    for (size_t i = 0; i < _vRetired.size(); )
+    {
+        if (_vRetired[i].epoch + 2 <= epoch)
+        {
+            _vRetired[i].deleter(_vRetired[i].p);
+            _vRetired[i] = _vRetired.back();
+            _vRetired.pop_back();
+            deleted++;
+        }
+        else
+            i++;
+    }
+    return deleted;
+}
+
+size_t EpochReclaimer::getPending() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _vRetired.size();
+}
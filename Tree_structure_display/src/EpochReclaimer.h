@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+
+// epoch based reclamation of the memory read by lock-free readers. A reader
+// holds a Guard while it reads, it announces the epoch it started in. A writer
+// unlinks the memory from the structure first, then retires it: it is deleted
+// once the epoch moved twice past its retirement, when no reader which could
+// have seen it is left. The readers never wait for the writers nor block them.
+class EpochReclaimer
+{
+    public:
+        static constexpr size_t SLOTS = 64; // reading threads at once, the next ones wait for a slot
+        static constexpr size_t HELD_MAX = 8; // reclaimers a thread reads at once, more take a slot per guard
+
+        EpochReclaimer() = default;
+        ~EpochReclaimer(); // deletes all the retired memory, no reader must be left
+
+        EpochReclaimer(const EpochReclaimer&) = delete;
+        EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+        // a reader in an epoch, the memory it reads is not deleted while it lives.
+        // The guards of a thread nest: only the outermost one takes a slot and
+        // announces the epoch, so a reader holds one slot whatever the nesting.
+        class Guard
+        {
+            public:
+                Guard(EpochReclaimer& reclaimer) : _reclaimer(reclaimer), _slot(reclaimer.enter()) {};
+                ~Guard() { _reclaimer.leave(_slot); };
+
+                Guard(const Guard&) = delete;
+                Guard& operator=(const Guard&) = delete;
+
+            private:
+                EpochReclaimer& _reclaimer;
+                size_t _slot;
+        };
+
+        // p, unlinked from the structure, is deleted once no reader can see it
+        template <class T>
+        void retire(T* p)
+        {
+            retire(p, [](void* q) { delete static_cast<T*>(q); });
+        }
+        void retire(void* p, void (*deleter)(void*));
+
+        // move the epoch if all the readers are in it and delete what no reader can
+        // see, the number deleted. Done by retire() every COLLECT_PERIOD retirements.
+        size_t collect();
+
+        inline uint64_t getEpoch() const { return _epoch.load(); };
+        size_t getPending() const; // retired, not deleted yet
+
+    private:
+        static constexpr size_t COLLECT_PERIOD = 64;
+
+        // the epoch of a reader, 0 when free. One cache line each, the readers do not share them.
+        struct alignas(64) Slot
+        {
+            std::atomic<uint64_t> epoch{0};
+        };
+
+        struct Retired
+        {
+            void* p;
+            void (*deleter)(void*);
+            uint64_t epoch;
+        };
+
+        size_t enter();
+        void leave(size_t slot);
+        size_t collectLocked();
+
+        Slot _vSlots[SLOTS];
+        std::atomic<uint64_t> _epoch{1};
+
+        mutable std::mutex _mutex; // the retired memory, taken by the writers only
+        std::vector<Retired> _vRetired;
+        size_t _retiredSinceCollect = 0;
+};
@@ -0,0 +1,134 @@
+#include "GlyphAtlas.h"
+
+#include <algorithm>
+#include <iostream>
+
+bool GlyphAtlas::build(TTF_Font* pFont)
+{
+    _width = 0;
+    _height = 0;
+    if (!pFont) return false;
+
+    int height = TTF_FontHeight(pFont);
+    if (height <= 0) return false;
+
+    // render every glyph in white, the alpha is the coverage
+    std::vector<SDL_Surface*> vSurfaces(LAST_CHAR - FIRST_CHAR + 1, nullptr);
+    int width = 0;
+    for (int c = FIRST_CHAR; c <= LAST_CHAR; c++)
+    {
+        Glyph& g = _glyphs[c - FIRST_CHAR];
+        int minx, maxx, miny, maxy, advance;
+        if (TTF_GlyphMetrics(pFont, (Uint16)c, &minx, &maxx, &miny, &maxy, &advance) < 0)
+            continue;
+        g.advance = advance;
+        g.offsetX = std::min(0, minx);
+
+        SDL_Surface* pGlyph = TTF_RenderGlyph_Blended(pFont, (Uint16)c, {255, 255, 255, 255});
+        if (!pGlyph) continue;
+        vSurfaces[c - FIRST_CHAR] = SDL_ConvertSurfaceFormat(pGlyph, SDL_PIXELFORMAT_ARGB8888, 0);
+        SDL_FreeSurface(pGlyph);
+        if (!vSurfaces[c - FIRST_CHAR]) continue;
+
+        g.x = width;
+        g.w = vSurfaces[c - FIRST_CHAR]->w;
+        width += g.w;
+    }
+
+    _vCoverage.assign((size_t)width * height, 0);
+    for (int c = FIRST_CHAR; c <= LAST_CHAR; c++)
+    {
+        SDL_Surface* pGlyph = vSurfaces[c - FIRST_CHAR];
+        if (!pGlyph) continue;
+
+        const Glyph& g = _glyphs[c - FIRST_CHAR];
+        for (int y = 0; y < std::min(height, pGlyph->h); y++)
+        {
+            const Uint32* row = (const Uint32*)((const Uint8*)pGlyph->pixels + y * pGlyph->pitch);
+            for (int x = 0; x < g.w; x++)
+                _vCoverage[(size_t)y * width + g.x + x] = (uint8_t)(row[x] >> 24);
+        }
+        SDL_FreeSurface(pGlyph);
+    }
+
+    _width = width;
+    _height = height;
+    std::cout << "DEBUG - glyph atlas " << _width << "x" << _height << std::endl;
+    return true;
+}
+
+int GlyphAtlas::measure(const char* str) const
+{
+    int w = 0;
+    for (const char* p = str; *p; p++)
+        w += glyph(*p).advance;
+    return w;
+}
+
+const GlyphAtlas::Glyph& GlyphAtlas::glyph(char c) const
+{
+    if (c < FIRST_CHAR || c > LAST_CHAR)
+        c = '?';
+    return _glyphs[c - FIRST_CHAR];
+}
+
+// call f(y, x, coverage) for the covered pixels of the string clipped to w x h
+template<class F>
+void GlyphAtlas::forEachPixel(const char* str, int x, int y, int w, int h, F f) const
+{
+    int y0 = std::max(0, -y);
+    int y1 = std::min(_height, h - y);
+
+    for (const char* p = str; *p && x < w; p++)
+    {
+        const Glyph& g = glyph(*p);
+        int gx = x + g.offsetX;
+        int x0 = std::max(0, -gx);
+        int x1 = std::min(g.w, w - gx);
+
+        for (int row = y0; row < y1; row++)
+        {
+            const uint8_t* coverage = &_vCoverage[(size_t)row * _width + g.x];
+            for (int col = x0; col < x1; col++)
+            {
+                if (coverage[col])
+                    f((y + row), gx + col, coverage[col]);
+            }
+        }
+        x += g.advance;
+    }
+}
+
+void GlyphAtlas::compose(const char* str, int x, int y, uint32_t color, uint32_t alphaMask,
+                         uint32_t* pixels, int pitch, int w, int h) const
+{
+    uint32_t rgb = color & ~alphaMask;
+    int shift = 0;
+    while (shift < 32 && !((alphaMask >> shift) & 1)) shift++;
+
+    forEachPixel(str, x, y, w, h, [&](int py, int px, uint8_t a)
+    {
+        uint32_t& dst = pixels[py * pitch + px];
+        // glyphs may overlap by a few pixels, keep the strongest coverage
+        if (((dst & alphaMask) >> shift) < a)
+            dst = rgb | ((uint32_t)a << shift);
+    });
+}
+
+void GlyphAtlas::blend(const char* str, int x, int y, uint32_t color,
+                       uint32_t* pixels, int pitch, int w, int h) const
+{
+    forEachPixel(str, x, y, w, h, [&](int py, int px, uint8_t a)
+    {
+        // per 8 bits channel, the alpha channel of the target stays opaque
+        uint32_t& dst = pixels[py * pitch + px];
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            uint32_t s = (color >> shift) & 0xff;
+            uint32_t d = (dst >> shift) & 0xff;
+            out |= ((s * a + d * (255 - a) + 127) / 255) << shift;
+        }
+        dst = out;
+    });
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "SDL2/SDL.h"
+#include "SDL2/SDL_ttf.h"
+
+
+// coverage of the printable ascii glyphs of a font, rasterised once with
+// SDL_ttf. Strings are then composed by copying the glyphs, without any
+// call to SDL_ttf nor allocation. No kerning, the other characters are
+// drawn as '?'.
+class GlyphAtlas
+{
+    public:
+        static constexpr int FIRST_CHAR = 32;
+        static constexpr int LAST_CHAR = 126;
+
+        bool build(TTF_Font* pFont);
+        inline bool isBuilt() const { return _height > 0; };
+        inline int getHeight() const { return _height; };
+
+        // width in pixels of the string
+        int measure(const char* str) const;
+
+        // write the glyphs at (x, y) of 32 bits pixels with the coverage as
+        // alpha, for a transparent surface blitted with blending. The color
+        // is packed as the target, its alpha bits are given by alphaMask.
+        void compose(const char* str, int x, int y, uint32_t color, uint32_t alphaMask,
+                     uint32_t* pixels, int pitch, int w, int h) const;
+
+        // blend the glyphs at (x, y) into opaque 32 bits pixels
+        void blend(const char* str, int x, int y, uint32_t color,
+                   uint32_t* pixels, int pitch, int w, int h) const;
+
+    private:
+        struct Glyph
+        {
+            int x = 0; // position in the atlas
+            int w = 0;
+            int offsetX = 0; // from the pen position
+            int advance = 0;
+        };
+
+        const Glyph& glyph(char c) const;
+        template<class F>
+        void forEachPixel(const char* str, int x, int y, int w, int h, F f) const;
+
+        int _width = 0;
+        int _height = 0;
+        std::vector<uint8_t> _vCoverage; // _width x _height
+        Glyph _glyphs[LAST_CHAR - FIRST_CHAR + 1];
+};
@@ -0,0 +1,137 @@
+#include "PerfCounters.h"
+
+#include <iostream>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+
+// destructor
+PerfCounters::~PerfCounters()
+{
+    close();
+}
+
+const char* PerfCounters::getName(Counter c)
+{
+    switch (c)
+    {
+        case CYCLES: return "cycles";
+        case INSTRUCTIONS: return "instructions";
+        case L1D_MISSES: return "L1d misses";
+        case LLC_MISSES: return "LLC misses";
+        case BRANCH_MISSES: return "branch misses";
+        default: return "unknown";
+    }
+}
+
+#ifdef __linux__
+
+bool PerfCounters::open()
+{
+    if (isOpen()) return true;
+
+    struct Config { Counter counter; uint32_t type; uint64_t config; };
+    const Config configs[COUNT] =
+    {
+        {CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {L1D_MISSES, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {LLC_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    int lastErrno = 0;
+    for (const auto& c : configs)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = c.type;
+        attr.config = c.config;
+        attr.disabled = (_leader < 0) ? 1 : 0; // the group starts with its leader
+        attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        // counters of this thread on any cpu
+        int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, _leader, 0);
+        if (fd < 0)
+        {
+            lastErrno = errno;
+            continue;
+        }
+
+        if (_leader < 0) _leader = fd;
+        _fds[c.counter] = fd;
+        _order[_nOpen++] = c.counter;
+    }
+
+    if (!isOpen())
+    {
+        std::cout << "WARNING - perf counters not available: " << strerror(lastErrno)
+                  << " (check /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        if (_fds[i] < 0)
+            std::cout << "WARNING - perf counter not supported: " << getName((Counter)i) << std::endl;
+    }
+
+    ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void PerfCounters::close()
+{
+    for (int i = 0; i < COUNT; i++)
+    {
+        if (_fds[i] >= 0)
+            ::close(_fds[i]);
+        _fds[i] = -1;
+    }
+    _nOpen = 0;
+    _leader = -1;
+}
+
+bool PerfCounters::read(Values& values) const
+{
+    if (!isOpen()) return false;
+
+    // layout of a group read: number of values followed by the values
+    uint64_t buffer[1 + COUNT];
+    if (::read(_leader, buffer, sizeof(buffer)) < (ssize_t)(sizeof(uint64_t) * (1 + _nOpen)))
+        return false;
+
+    for (int i = 0; i < (int)buffer[0] && i < _nOpen; i++)
+        values.v[_order[i]] = buffer[1 + i];
+    return true;
+}
+
+#else
+
+bool PerfCounters::open()
+{
+    std::cout << "WARNING - perf counters are only available on linux." << std::endl;
+    return false;
+}
+
+void PerfCounters::close() {}
+
+bool PerfCounters::read(Values& values) const
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+
+// hardware performance counters of the calling thread using linux perf_event_open.
+// The counters run freely once opened and are read as snapshots, so the
+// difference of two snapshots gives the events of a code section (sections can
+// be nested). On other systems, or when perf events are not permitted
+// (see /proc/sys/kernel/perf_event_paranoid), open() fails and nothing is counted.
+class PerfCounters
+{
+    public:
+        enum Counter
+        {
+            CYCLES = 0,
+            INSTRUCTIONS,
+            L1D_MISSES,
+            LLC_MISSES,
+            BRANCH_MISSES,
+            COUNT
+        };
+
+        struct Values
+        {
+            uint64_t v[COUNT] = {};
+        };
+
+    public:
+        PerfCounters() = default;
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        // open and start the counters, returns false if not available
+        bool open();
+        void close();
+
+        inline bool isOpen() const { return _nOpen > 0; };
+        // a counter may be missing on some cpus/vms even if the others work
+        inline bool hasCounter(Counter c) const { return _fds[c] >= 0; };
+
+        // current values since open()
+        bool read(Values& values) const;
+
+        static const char* getName(Counter c);
+
+    private:
+        int _fds[COUNT] = {-1, -1, -1, -1, -1};
+        int _order[COUNT] = {}; // counter of each value in the group read
+        int _nOpen = 0;
+        int _leader = -1;
+};
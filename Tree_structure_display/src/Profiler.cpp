@@ -0,0 +1,226 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+// constructor
+FrameProfiler::FrameProfiler(size_t historySize) : _historySize(std::max<size_t>(historySize, 1))
+{
+    _vScratch.reserve(_historySize);
+}
+
+int FrameProfiler::addPhase(const std::string& name)
+{
+    for (size_t i = 0; i < _vPhases.size(); i++)
+    {
+        if (_vPhases[i]._name == name)
+            return (int)i;
+    }
+
+    Phase phase;
+    phase._name = name;
+    phase._vHistory.resize(_historySize, 0.0f);
+    _vPhases.push_back(phase);
+    return (int)_vPhases.size() - 1;
+}
+
+void FrameProfiler::addSample(int phase, double ms)
+{
+    if (phase < 0 || phase >= (int)_vPhases.size()) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _vPhases[phase]._current += ms;
+    _vPhases[phase]._bSampled = true;
+}
+
+void FrameProfiler::addCounters(int phase, const PerfCounters::Values& start, const PerfCounters::Values& end)
+{
+    if (phase < 0 || phase >= (int)_vPhases.size()) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (int i = 0; i < PerfCounters::COUNT; i++)
+        _vPhases[phase]._counters.values.v[i] += end.v[i] - start.v[i];
+}
+
+void FrameProfiler::addAllocations(int phase, const alloc::Counts& start, const alloc::Counts& end)
+{
+    if (phase < 0 || phase >= (int)_vPhases.size()) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _vPhases[phase]._counters.allocations += end.allocations - start.allocations;
+    _vPhases[phase]._counters.allocatedBytes += end.bytes - start.bytes;
+}
+
+void FrameProfiler::addItems(int phase, size_t n)
+{
+    if (phase < 0 || phase >= (int)_vPhases.size()) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _vPhases[phase]._counters.items += n;
+}
+
+void FrameProfiler::endFrame()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto& phase : _vPhases)
+    {
+        // phases not running in this frame (ex. another tree) keep their history
+        if (!phase._bSampled) continue;
+
+        phase._vHistory[phase._head] = (float)phase._current;
+        phase._head = (phase._head + 1) % _historySize;
+        phase._count = std::min(phase._count + 1, _historySize);
+        phase._total += phase._current;
+        phase._totalFrames++;
+
+        phase._lastCounters = phase._counters;
+        for (int i = 0; i < PerfCounters::COUNT; i++)
+            phase._totalCounters.values.v[i] += phase._counters.values.v[i];
+        phase._totalCounters.items += phase._counters.items;
+        phase._totalCounters.allocations += phase._counters.allocations;
+        phase._totalCounters.allocatedBytes += phase._counters.allocatedBytes;
+
+        phase._current = 0.0;
+        phase._bSampled = false;
+        phase._counters = PhaseCounters();
+    }
+    _frameCount++;
+}
+
+FrameProfiler::PhaseStats FrameProfiler::getStats(int phase) const
+{
+    PhaseStats stats;
+    if (phase < 0 || phase >= (int)_vPhases.size()) return stats;
+
+    const Phase& p = _vPhases[phase];
+    if (p._count == 0) return stats;
+
+    // the history is not ordered when not full, but only the first _count values are valid
+    _vScratch.assign(p._vHistory.begin(), p._vHistory.begin() + p._count);
+
+    double sum = 0.0;
+    for (float v : _vScratch) sum += v;
+
+    size_t i99 = std::min(p._count - 1, (size_t)(0.99 * (double)p._count));
+    std::nth_element(_vScratch.begin(), _vScratch.begin() + i99, _vScratch.end());
+
+    stats.last = p._vHistory[(p._head + _historySize - 1) % _historySize];
+    stats.min = *std::min_element(_vScratch.begin(), _vScratch.end());
+    stats.max = *std::max_element(_vScratch.begin(), _vScratch.end());
+    stats.avg = (float)(sum / (double)p._count);
+    stats.p99 = _vScratch[i99];
+    stats.frames = p._count;
+    return stats;
+}
+
+bool FrameProfiler::dump(const std::string& filename) const
+{
+    std::ofstream file(filename);
+    if (!file.good())
+        return false;
+
+    file << "# frames: " << _frameCount << ", history: " << _historySize << " frames, times in ms" << std::endl;
+    file << std::left << std::setw(12) << "phase"
+         << std::right << std::setw(10) << "frames"
+         << std::setw(10) << "min"
+         << std::setw(10) << "avg"
+         << std::setw(10) << "p99"
+         << std::setw(10) << "max"
+         << std::setw(12) << "avg(all)" << std::endl;
+
+    file << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < _vPhases.size(); i++)
+    {
+        PhaseStats stats = getStats((int)i);
+        double avgAll = _vPhases[i]._totalFrames ? _vPhases[i]._total / _vPhases[i]._totalFrames : 0.0;
+
+        file << std::left << std::setw(12) << _vPhases[i]._name
+             << std::right << std::setw(10) << _vPhases[i]._totalFrames
+             << std::setw(10) << stats.min
+             << std::setw(10) << stats.avg
+             << std::setw(10) << stats.p99
+             << std::setw(10) << stats.max
+             << std::setw(12) << avgAll << std::endl;
+    }
+
+    if (alloc::isEnabled())
+    {
+        file << std::endl << "# heap allocations (all frames)" << std::endl;
+        file << std::left << std::setw(12) << "phase"
+             << std::right << std::setw(14) << "allocs"
+             << std::setw(14) << "allocs/frame"
+             << std::setw(14) << "bytes/frame" << std::endl;
+
+        for (const auto& phase : _vPhases)
+        {
+            double n = phase._totalFrames ? (double)phase._totalFrames : 1.0;
+            file << std::left << std::setw(12) << phase._name
+                 << std::right << std::setw(14) << phase._totalCounters.allocations
+                 << std::setw(14) << phase._totalCounters.allocations / n
+                 << std::setw(14) << phase._totalCounters.allocatedBytes / n << std::endl;
+        }
+    }
+
+    if (!_pCounters)
+        return true;
+
+    // hardware counters since start
+    file << std::endl << "# hardware counters (all frames), per object when the phase reports objects" << std::endl;
+    file << std::left << std::setw(12) << "phase"
+         << std::right << std::setw(10) << "IPC"
+         << std::setw(14) << "objects"
+         << std::setw(14) << "L1d miss/obj"
+         << std::setw(14) << "LLC miss/obj"
+         << std::setw(14) << "br miss/obj" << std::endl;
+
+    for (const auto& phase : _vPhases)
+    {
+        const PerfCounters::Values& v = phase._totalCounters.values;
+        double n = phase._totalCounters.items ? (double)phase._totalCounters.items : 1.0;
+        double ipc = v.v[PerfCounters::CYCLES] ? (double)v.v[PerfCounters::INSTRUCTIONS] / v.v[PerfCounters::CYCLES] : 0.0;
+
+        file << std::left << std::setw(12) << phase._name
+             << std::right << std::setw(10) << ipc
+             << std::setw(14) << phase._totalCounters.items
+             << std::setw(14) << v.v[PerfCounters::L1D_MISSES] / n
+             << std::setw(14) << v.v[PerfCounters::LLC_MISSES] / n
+             << std::setw(14) << v.v[PerfCounters::BRANCH_MISSES] / n << std::endl;
+    }
+
+    return true;
+}
+
+void CpuUsage::reset()
+{
+    _cpuStart = _cpuPeriod = std::clock();
+    _wallStart = _wallPeriod = Clock::now();
+    _last = 0.0;
+}
+
+double CpuUsage::update(double period)
+{
+    Clock::time_point now = Clock::now();
+    std::chrono::duration<double> wall = now - _wallPeriod;
+    if (wall.count() < period)
+        return _last;
+
+    std::clock_t cpu = std::clock();
+    _last = 100.0 * (double)(cpu - _cpuPeriod) / CLOCKS_PER_SEC / wall.count();
+    _cpuPeriod = cpu;
+    _wallPeriod = now;
+    return _last;
+}
+
+double CpuUsage::getTotal() const
+{
+    double wall = getWallSeconds();
+    if (wall <= 0.0) return 0.0;
+    return 100.0 * (double)(std::clock() - _cpuStart) / CLOCKS_PER_SEC / wall;
+}
+
+double CpuUsage::getWallSeconds() const
+{
+    std::chrono::duration<double> wall = Clock::now() - _wallStart;
+    return wall.count();
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <mutex>
+
+#include "PerfCounters.h"
+#include "AllocTracker.h"
+
+
+// collects per-phase timings of each frame and keeps a rolling history
+// of the last N frames to compute min/avg/p99.
+// The samples can be added from several threads, they go to the frame
+// being built; the history is read by the thread calling endFrame.
+class FrameProfiler
+{
+    public:
+        struct PhaseStats
+        {
+            float last = 0.0f; // all values in ms
+            float min = 0.0f;
+            float avg = 0.0f;
+            float p99 = 0.0f;
+            float max = 0.0f;
+            size_t frames = 0; // number of frames in the history
+        };
+
+        // hardware counters of the last frame a phase ran
+        struct PhaseCounters
+        {
+            PerfCounters::Values values;
+            size_t items = 0; // objects processed by the phase, see addItems()
+            uint64_t allocations = 0; // heap allocations, with the alloc tracker only
+            uint64_t allocatedBytes = 0;
+        };
+
+    public:
+        FrameProfiler(size_t historySize = 240);
+
+        // register a phase, returns its id (the same id if the name exists)
+        int addPhase(const std::string& name);
+
+        // accumulate a sample in the current frame, a phase can be sampled
+        // several times per frame (ex. DrawText)
+        void addSample(int phase, double ms);
+
+        // attach hardware counters, every phase then also counts the events
+        // between the start and the end of its timers. nullptr to detach.
+        inline void setCounters(const PerfCounters* pCounters) { _pCounters = pCounters; };
+        inline const PerfCounters* getCounters() const { return _pCounters; };
+        void addCounters(int phase, const PerfCounters::Values& start, const PerfCounters::Values& end);
+
+        // heap allocations between two snapshots of the alloc tracker
+        void addAllocations(int phase, const alloc::Counts& start, const alloc::Counts& end);
+
+        // number of objects handled by the phase in this frame, to report events per object
+        void addItems(int phase, size_t n);
+        inline const PhaseCounters& getPhaseCounters(int phase) const { return _vPhases[phase]._lastCounters; };
+
+        // push the accumulated samples of the frame into the history
+        void endFrame();
+
+        PhaseStats getStats(int phase) const;
+        inline size_t getPhaseCount() const { return _vPhases.size(); };
+        inline const std::string& getPhaseName(int phase) const { return _vPhases[phase]._name; };
+        inline size_t getFrameCount() const { return _frameCount; };
+
+        // write the statistics of all phases to a text file
+        bool dump(const std::string& filename) const;
+
+    private:
+        struct Phase
+        {
+            std::string _name;
+            std::vector<float> _vHistory; // ring buffer of the last frames
+            size_t _head = 0;
+            size_t _count = 0;
+            double _current = 0.0; // accumulated time in the current frame
+            bool _bSampled = false; // whether the phase ran in the current frame
+            double _total = 0.0; // since start, for the dump
+            size_t _totalFrames = 0;
+
+            PhaseCounters _counters; // current frame
+            PhaseCounters _lastCounters;
+            PhaseCounters _totalCounters;
+        };
+
+        size_t _historySize;
+        size_t _frameCount = 0;
+        std::vector<Phase> _vPhases;
+        const PerfCounters* _pCounters = nullptr;
+        mutable std::vector<float> _vScratch; // to sort the history without allocation
+        std::mutex _mutex; // the samples of the current frame
+};
+
+
+// measure the time between construction and destruction and add it to
+// a phase of the profiler
+class ScopedTimer
+{
+    public:
+        ScopedTimer(FrameProfiler& profiler, int phase) :
+            _profiler(profiler),
+            _phase(phase),
+            _start(std::chrono::steady_clock::now())
+        {
+            if (_profiler.getCounters())
+                _bCounting = _profiler.getCounters()->read(_startCounters);
+            if (alloc::isEnabled())
+                _startAllocs = alloc::current();
+        };
+
+        ~ScopedTimer()
+        {
+            std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - _start;
+            _profiler.addSample(_phase, d.count());
+
+            PerfCounters::Values endCounters;
+            if (_bCounting && _profiler.getCounters() && _profiler.getCounters()->read(endCounters))
+                _profiler.addCounters(_phase, _startCounters, endCounters);
+
+            if (alloc::isEnabled())
+                _profiler.addAllocations(_phase, _startAllocs, alloc::current());
+        };
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        FrameProfiler& _profiler;
+        int _phase;
+        std::chrono::steady_clock::time_point _start;
+        PerfCounters::Values _startCounters;
+        bool _bCounting = false;
+        alloc::Counts _startAllocs;
+};
+
+
+// cpu time of the process (all threads) against the wall time, in percent
+// of one core. Shows whether an idle loop really sleeps.
+class CpuUsage
+{
+    public:
+        CpuUsage() { reset(); };
+
+        void reset();
+
+        // the usage over the last complete period of the given seconds
+        double update(double period = 1.0);
+        inline double getLast() const { return _last; };
+
+        // the usage since reset
+        double getTotal() const;
+        double getWallSeconds() const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        std::clock_t _cpuStart;
+        Clock::time_point _wallStart;
+        std::clock_t _cpuPeriod; // start of the current period
+        Clock::time_point _wallPeriod;
+        double _last = 0.0;
+};
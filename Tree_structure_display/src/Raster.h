@@ -0,0 +1,197 @@
+#pragma once
+
+// Span kernels for the software rasteriser. A span is a run of pixels of
+// one row, the caller clips it against the target before the call.
+// The vector paths are selected at compile time: SSE2 is always on x86-64,
+// AVX2 needs -mavx2 (cmake -DENABLE_AVX2=ON).
+
+#include <cstdint>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace raster
+{
+#if defined(__AVX2__)
+    constexpr const char* SIMD_NAME = "AVX2";
+#elif defined(__SSE2__)
+    constexpr const char* SIMD_NAME = "SSE2";
+#else
+    constexpr const char* SIMD_NAME = "scalar";
+#endif
+
+    // fill the pixels [x0, x1] of a row with a packed color
+    inline void fillSpan(uint32_t* row, int x0, int x1, uint32_t color)
+    {
+        uint32_t* p = row + x0;
+        int n = x1 - x0 + 1;
+
+#if defined(__AVX2__)
+        const __m256i c8 = _mm256_set1_epi32((int)color);
+        for (; n >= 8; n -= 8, p += 8)
+            _mm256_storeu_si256((__m256i*)p, c8);
+#endif
+#if defined(__SSE2__)
+        const __m128i c4 = _mm_set1_epi32((int)color);
+        for (; n >= 4; n -= 4, p += 4)
+            _mm_storeu_si128((__m128i*)p, c4);
+#endif
+        for (; n > 0; n--)
+            *p++ = color;
+    }
+
+    // how a color is written over the pixels, with its alpha (0..255) given
+    // apart from the packed color
+    enum class Blend : uint8_t
+    {
+        COPY = 0, // the color replaces the pixels, the alpha is ignored
+        OVER, // source over: color * alpha + pixel * (1 - alpha)
+        ADD, // pixel + color * alpha, saturated
+    };
+
+    // the weight of the alpha in 1/256, so 255 keeps the color exactly
+    inline uint32_t alphaWeight(uint32_t alpha)
+    {
+        return alpha + (alpha >> 7);
+    }
+
+    // source over of one pixel, the channels are blended in pairs 8 bits apart
+    inline uint32_t blendPixel(uint32_t dst, uint32_t color, uint32_t a)
+    {
+        uint32_t ia = 256 - a;
+        uint32_t rb = ((color & 0x00ff00ff) * a + (dst & 0x00ff00ff) * ia) >> 8;
+        uint32_t ga = ((color >> 8) & 0x00ff00ff) * a + ((dst >> 8) & 0x00ff00ff) * ia;
+        return (rb & 0x00ff00ff) | (ga & 0xff00ff00);
+    }
+
+    // saturated add of the channels of a color premultiplied by its alpha
+    inline uint32_t addPixel(uint32_t dst, uint32_t premultiplied)
+    {
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            uint32_t c = ((dst >> shift) & 0xff) + ((premultiplied >> shift) & 0xff);
+            out |= (c > 255 ? 255 : c) << shift;
+        }
+        return out;
+    }
+
+    // the channels of the color multiplied by the alpha weight
+    inline uint32_t premultiply(uint32_t color, uint32_t a)
+    {
+        uint32_t rb = (((color & 0x00ff00ff) * a) >> 8) & 0x00ff00ff;
+        uint32_t ga = (((color >> 8) & 0x00ff00ff) * a) & 0xff00ff00;
+        return rb | ga;
+    }
+
+    // reference scalar paths of the blended spans, also used for the remainders
+    inline void blendSpanScalar(uint32_t* p, int n, uint32_t color, uint32_t a)
+    {
+        for (; n > 0; n--, p++)
+            *p = blendPixel(*p, color, a);
+    }
+
+    inline void addSpanScalar(uint32_t* p, int n, uint32_t premultiplied)
+    {
+        for (; n > 0; n--, p++)
+            *p = addPixel(*p, premultiplied);
+    }
+
+    // source over of the pixels [x0, x1] of a row, 8 bits channels widened to 16 bits
+    inline void blendSpan(uint32_t* row, int x0, int x1, uint32_t color, uint32_t alpha)
+    {
+        uint32_t* p = row + x0;
+        int n = x1 - x0 + 1;
+        uint32_t a = alphaWeight(alpha);
+
+#if defined(__AVX2__)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i ia8 = _mm256_set1_epi16((short)(256 - a));
+            const __m256i ca8 = _mm256_mullo_epi16(_mm256_unpacklo_epi8(_mm256_set1_epi32((int)color), zero),
+                                                   _mm256_set1_epi16((short)a));
+            for (; n >= 8; n -= 8, p += 8)
+            {
+                __m256i d = _mm256_loadu_si256((const __m256i*)p);
+                __m256i lo = _mm256_unpacklo_epi8(d, zero);
+                __m256i hi = _mm256_unpackhi_epi8(d, zero);
+                lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(lo, ia8), ca8), 8);
+                hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(hi, ia8), ca8), 8);
+                _mm256_storeu_si256((__m256i*)p, _mm256_packus_epi16(lo, hi));
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i ia4 = _mm_set1_epi16((short)(256 - a));
+            const __m128i ca4 = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero),
+                                                _mm_set1_epi16((short)a));
+            for (; n >= 4; n -= 4, p += 4)
+            {
+                __m128i d = _mm_loadu_si128((const __m128i*)p);
+                __m128i lo = _mm_unpacklo_epi8(d, zero);
+                __m128i hi = _mm_unpackhi_epi8(d, zero);
+                lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, ia4), ca4), 8);
+                hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, ia4), ca4), 8);
+                _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(lo, hi));
+            }
+        }
+#endif
+        blendSpanScalar(p, n, color, a);
+    }
+
+    // additive blend of the pixels [x0, x1] of a row, one saturated add per 4 or 8 pixels
+    inline void addSpan(uint32_t* row, int x0, int x1, uint32_t color, uint32_t alpha)
+    {
+        uint32_t* p = row + x0;
+        int n = x1 - x0 + 1;
+        uint32_t c = premultiply(color, alphaWeight(alpha));
+
+#if defined(__AVX2__)
+        const __m256i c8 = _mm256_set1_epi32((int)c);
+        for (; n >= 8; n -= 8, p += 8)
+            _mm256_storeu_si256((__m256i*)p, _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)p), c8));
+#endif
+#if defined(__SSE2__)
+        const __m128i c4 = _mm_set1_epi32((int)c);
+        for (; n >= 4; n -= 4, p += 4)
+            _mm_storeu_si128((__m128i*)p, _mm_adds_epu8(_mm_loadu_si128((const __m128i*)p), c4));
+#endif
+        addSpanScalar(p, n, c);
+    }
+
+    // the span of the blend mode, an opaque source over is a plain fill
+    inline void drawSpan(uint32_t* row, int x0, int x1, uint32_t color, Blend blend, uint32_t alpha)
+    {
+        if (blend == Blend::COPY || (blend == Blend::OVER && alpha >= 255))
+            fillSpan(row, x0, x1, color);
+        else if (alpha == 0)
+            return;
+        else if (blend == Blend::OVER)
+            blendSpan(row, x0, x1, color, alpha);
+        else
+            addSpan(row, x0, x1, color, alpha);
+    }
+
+    // one pixel of the blend mode
+    inline void drawPixel(uint32_t& dst, uint32_t color, Blend blend, uint32_t alpha)
+    {
+        if (blend == Blend::COPY || (blend == Blend::OVER && alpha >= 255))
+            dst = color;
+        else if (blend == Blend::OVER)
+            dst = blendPixel(dst, color, alphaWeight(alpha));
+        else
+            dst = addPixel(dst, premultiply(color, alphaWeight(alpha)));
+    }
+
+    // half width of the row dy of a disc of radius r, as the midpoint circle
+    // which is inside (r + 0.5)^2
+    inline int circleHalfWidth(int r, int dy)
+    {
+        float r2 = (float)r * (float)r + (float)r;
+        return (int)sqrtf(r2 - (float)dy * (float)dy);
+    }
+}
@@ -0,0 +1,108 @@
+#include "SpatialOrder.h"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <random>
+
+namespace spatial
+{
+    // elements per chunk of the parallel passes, below the work is not split
+    static const size_t CHUNK_MIN = 1 << 14;
+
+    const char* getName(Order order)
+    {
+        const char* names[] = {"random", "morton", "hilbert"};
+        return names[(int)order];
+    }
+
+    void sortOrder(const std::vector<uint32_t>& keys, std::vector<uint32_t>& order, ThreadPool& pool)
+    {
+        size_t n = keys.size();
+        size_t nChunks = std::max((size_t)1, std::min(pool.getWorkerCount() + 1, n / CHUNK_MIN));
+        size_t chunkSize = (n + nChunks - 1) / nChunks;
+
+        std::vector<uint32_t> vKeys(keys), vKeysTmp(n);
+        std::vector<uint32_t> vOrder(n), vOrderTmp(n);
+        std::iota(vOrder.begin(), vOrder.end(), 0);
+        std::vector<std::array<size_t, 256>> vHist(nChunks);
+
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            // count the digits of each chunk
+            pool.parallelFor(nChunks, [&](size_t c)
+            {
+                auto& hist = vHist[c];
+                hist.fill(0);
+                size_t end = std::min(n, (c + 1) * chunkSize);
+                for (size_t i = c * chunkSize; i < end; i++)
+                    hist[(vKeys[i] >> shift) & 0xff]++;
+            });
+
+            // the offset of each chunk in each digit, the chunks in order so the sort is stable
+            size_t offset = 0;
+            bool bSingleDigit = false;
+            for (int d = 0; d < 256; d++)
+            {
+                size_t count = 0;
+                for (size_t c = 0; c < nChunks; c++)
+                {
+                    size_t h = vHist[c][d];
+                    vHist[c][d] = offset + count;
+                    count += h;
+                }
+                bSingleDigit |= (count == n);
+                offset += count;
+            }
+            if (bSingleDigit) continue; // all keys share the digit, nothing moves
+
+            pool.parallelFor(nChunks, [&](size_t c)
+            {
+                auto& pos = vHist[c];
+                size_t end = std::min(n, (c + 1) * chunkSize);
+                for (size_t i = c * chunkSize; i < end; i++)
+                {
+                    size_t p = pos[(vKeys[i] >> shift) & 0xff]++;
+                    vKeysTmp[p] = vKeys[i];
+                    vOrderTmp[p] = vOrder[i];
+                }
+            });
+            vKeys.swap(vKeysTmp);
+            vOrder.swap(vOrderTmp);
+        }
+
+        order.swap(vOrder);
+    }
+
+    void computeOrder(Order order, const float* xs, const float* ys, size_t n,
+                      float x0, float y0, float w, float h,
+                      std::vector<uint32_t>& permutation, ThreadPool& pool)
+    {
+        if (order == Order::RANDOM)
+        {
+            permutation.resize(n);
+            std::iota(permutation.begin(), permutation.end(), 0);
+            std::shuffle(permutation.begin(), permutation.end(), std::mt19937(1));
+            return;
+        }
+
+        // the positions quantised on the 16 bits of the keys
+        std::vector<uint32_t> keys(n);
+        float sx = 65535.0f / std::max(w, 1.0f);
+        float sy = 65535.0f / std::max(h, 1.0f);
+        size_t nChunks = std::max((size_t)1, std::min(pool.getWorkerCount() + 1, n / CHUNK_MIN));
+        size_t chunkSize = (n + nChunks - 1) / nChunks;
+        pool.parallelFor(nChunks, [&](size_t c)
+        {
+            size_t end = std::min(n, (c + 1) * chunkSize);
+            for (size_t i = c * chunkSize; i < end; i++)
+            {
+                uint32_t qx = (uint32_t)std::min(65535.0f, std::max(0.0f, (xs[i] - x0) * sx));
+                uint32_t qy = (uint32_t)std::min(65535.0f, std::max(0.0f, (ys[i] - y0) * sy));
+                keys[i] = (order == Order::HILBERT) ? hilbertKey(qx, qy) : mortonKey(qx, qy);
+            }
+        });
+
+        sortOrder(keys, permutation, pool);
+    }
+}
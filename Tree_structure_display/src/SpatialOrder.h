@@ -0,0 +1,75 @@
+#pragma once
+
+// Orders of objects along a space filling curve, so the objects close in
+// space are close in memory. The positions are quantised on 16 bits in the
+// area of the scene and the 32 bits keys are sorted by a parallel radix sort.
+
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace spatial
+{
+    enum class Order
+    {
+        RANDOM = 0, // shuffled, the order unrelated to space
+        MORTON, // z-order, bits of x and y interleaved
+        HILBERT, // no jump between neighbour keys
+    };
+
+    const char* getName(Order order);
+
+    // spread the 16 bits of v on the even bits
+    inline uint32_t spreadBits(uint32_t v)
+    {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    inline uint32_t mortonKey(uint32_t x, uint32_t y)
+    {
+        return spreadBits(x) | (spreadBits(y) << 1);
+    }
+
+    // distance along the hilbert curve of a 65536 x 65536 grid
+    inline uint32_t hilbertKey(uint32_t x, uint32_t y)
+    {
+        const uint32_t n = 1u << 16;
+        uint32_t d = 0;
+        for (uint32_t s = n >> 1; s > 0; s >>= 1)
+        {
+            uint32_t rx = (x & s) ? 1 : 0;
+            uint32_t ry = (y & s) ? 1 : 0;
+            d += s * s * ((3 * rx) ^ ry);
+
+            // rotate the quadrant so the curve is continuous
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = n - 1 - x;
+                    y = n - 1 - y;
+                }
+                uint32_t t = x;
+                x = y;
+                y = t;
+            }
+        }
+        return d;
+    }
+
+    // the permutation sorting keys, stable: an LSD radix sort of 8 bits digits,
+    // the histograms and the scatter of each digit are split between the threads
+    void sortOrder(const std::vector<uint32_t>& keys, std::vector<uint32_t>& order, ThreadPool& pool);
+
+    // the permutation of the points (xs[i], ys[i]) in the order: order[k] is the
+    // index of the k-th point. The area is the one the keys are quantised in.
+    void computeOrder(Order order, const float* xs, const float* ys, size_t n,
+                      float x0, float y0, float w, float h,
+                      std::vector<uint32_t>& permutation, ThreadPool& pool);
+}
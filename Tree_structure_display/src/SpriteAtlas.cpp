@@ -0,0 +1,107 @@
+#include "SpriteAtlas.h"
+
+#include <fstream>
+#include <iostream>
+
+#include "SDL2/SDL_image.h"
+
+SpriteAtlas::~SpriteAtlas()
+{
+    release();
+}
+
+void SpriteAtlas::release()
+{
+    SDL_FreeSurface(_pSurface);
+    _pSurface = nullptr;
+    _vViews.clear();
+}
+
+bool SpriteAtlas::create(int w, int h)
+{
+    release();
+    _pSurface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!_pSurface)
+    {
+        std::cout << "ERR - sprite atlas cannot be created. SDL_Error :" << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    SDL_FillRect(_pSurface, NULL, 0);
+    _alphaMask = _pSurface->format->Amask;
+    return true;
+}
+
+bool SpriteAtlas::load(const std::string& filename)
+{
+    release();
+    if (!std::ifstream(filename.c_str()).good())
+    {
+        std::cout << "ERR - sprite atlas " << filename << " not found" << std::endl;
+        return false;
+    }
+
+    SDL_Surface* pImage = IMG_Load(filename.c_str());
+    if (!pImage)
+    {
+        std::cout << "ERR - unable to load " << filename << ", SDL_image Error: " << IMG_GetError() << std::endl;
+        return false;
+    }
+
+    // the format of the image is only known here, the atlas keeps its pixels in the canvas format
+    _pSurface = SDL_ConvertSurfaceFormat(pImage, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(pImage);
+    if (!_pSurface)
+    {
+        std::cout << "ERR - sprite atlas cannot be converted. SDL_Error :" << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    _alphaMask = _pSurface->format->Amask;
+    std::cout << "DEBUG - sprite atlas " << _pSurface->w << "x" << _pSurface->h << std::endl;
+    return true;
+}
+
+int SpriteAtlas::add(const SDL_Rect& rect)
+{
+    if (!_pSurface || rect.w <= 0 || rect.h <= 0 || rect.x < 0 || rect.y < 0 ||
+        rect.x + rect.w > _pSurface->w || rect.y + rect.h > _pSurface->h)
+        return -1;
+
+    View v;
+    v.pitch = getPitch();
+    v.pixels = (const Uint32*)_pSurface->pixels + rect.y * v.pitch + rect.x;
+    v.w = rect.w;
+    v.h = rect.h;
+
+    // the blitter copies the rows of the opaque sprites and tests the alpha of the others
+    for (int y = 0; y < v.h && v.bOpaque; y++)
+    {
+        for (int x = 0; x < v.w; x++)
+        {
+            if ((v.pixels[y * v.pitch + x] & _alphaMask) != _alphaMask)
+            {
+                v.bOpaque = false;
+                break;
+            }
+        }
+    }
+
+    _vViews.push_back(v);
+    return (int)_vViews.size() - 1;
+}
+
+void SpriteAtlas::addGrid(int w, int h)
+{
+    if (w <= 0 || h <= 0) return;
+    for (int y = 0; y + h <= getHeight(); y += h)
+    {
+        for (int x = 0; x + w <= getWidth(); x += w)
+            add({x, y, w, h});
+    }
+}
+
+void SpriteAtlas::clearSprites()
+{
+    _vViews.clear();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SDL2/SDL.h"
+
+
+// sprites sharing one 32 bits pixel buffer, packed as the canvas
+// (SDL_PIXELFORMAT_RGBA32, see SDLCommon::convertColorUint). A sprite is
+// a view into the buffer, the pixels are never copied per sprite.
+class SpriteAtlas
+{
+    public:
+        struct View
+        {
+            const Uint32* pixels = nullptr; // top left pixel of the sprite in the atlas
+            int w = 0;
+            int h = 0;
+            int pitch = 0; // in pixels, the atlas width
+            bool bOpaque = true; // no transparent pixel, the rows are copied as they are
+        };
+
+        SpriteAtlas() = default;
+        ~SpriteAtlas();
+
+        SpriteAtlas(const SpriteAtlas&) = delete;
+        SpriteAtlas& operator=(const SpriteAtlas&) = delete;
+
+        // an empty atlas of w x h transparent pixels, to be drawn into with getPixels()
+        bool create(int w, int h);
+        // an atlas of the image, converted once to the canvas format
+        bool load(const std::string& filename);
+
+        // add the sprite of the atlas rectangle, returns its index or -1 if outside
+        int add(const SDL_Rect& rect);
+        // add the sprites of a grid of w x h cells, row by row
+        void addGrid(int w, int h);
+        void clearSprites();
+
+        inline const View& view(int sprite) const { return _vViews[sprite]; };
+        inline int getSpriteCount() const { return (int)_vViews.size(); };
+        inline bool isValid(int sprite) const { return sprite >= 0 && sprite < (int)_vViews.size(); };
+
+        // pixels of the atlas, to be written before add()
+        inline Uint32* getPixels() { return _pSurface ? (Uint32*)_pSurface->pixels : nullptr; };
+        inline int getPitch() const { return _pSurface ? _pSurface->pitch / 4 : 0; };
+        inline int getWidth() const { return _pSurface ? _pSurface->w : 0; };
+        inline int getHeight() const { return _pSurface ? _pSurface->h : 0; };
+        inline Uint32 getAlphaMask() const { return _alphaMask; };
+
+    private:
+        SDL_Surface* _pSurface = nullptr; // owned, in SDL_PIXELFORMAT_RGBA32
+        Uint32 _alphaMask = 0;
+        std::vector<View> _vViews;
+
+        void release();
+};
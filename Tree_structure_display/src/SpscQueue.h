@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+
+// bounded lock-free queue for one producer thread and one consumer thread
+template<class T, size_t N>
+class SpscQueue
+{
+    static_assert((N & (N - 1)) == 0, "the capacity must be a power of 2");
+
+    public:
+        // false if the queue is full
+        bool push(const T& value)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head - _tail.load(std::memory_order_acquire) == N)
+                return false;
+            _items[head & (N - 1)] = value;
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        };
+
+        // false if the queue is empty
+        bool pop(T& value)
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail == _head.load(std::memory_order_acquire))
+                return false;
+            value = _items[tail & (N - 1)];
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        };
+
+    private:
+        T _items[N];
+        alignas(64) std::atomic<size_t> _head{0}; // written by the producer
+        alignas(64) std::atomic<size_t> _tail{0}; // written by the consumer
+};
@@ -0,0 +1,175 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+// the pool of the calling thread and its queue in it
+static thread_local const ThreadPool* tPool = nullptr;
+static thread_local size_t tIndex = 0;
+
+bool ThreadPool::Queue::push(const Task& task)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tail - head == CAPACITY) return false;
+    vTasks[tail % CAPACITY] = task;
+    tail++;
+    return true;
+}
+
+bool ThreadPool::Queue::popBack(Task& task)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tail == head) return false;
+    tail--;
+    task = vTasks[tail % CAPACITY];
+    return true;
+}
+
+bool ThreadPool::Queue::popFront(Task& task)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tail == head) return false;
+    task = vTasks[head % CAPACITY];
+    head++;
+    return true;
+}
+
+// constructor
+ThreadPool::ThreadPool(int nWorkers)
+{
+    if (nWorkers < 0)
+        nWorkers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+    for (int i = 0; i <= nWorkers; i++)
+        _vQueues.push_back(std::make_unique<Queue>());
+    for (int i = 0; i < nWorkers; i++)
+        _vWorkers.emplace_back(&ThreadPool::workerLoop, this, (size_t)i);
+}
+
+// destructor
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _bStop = true;
+    }
+    _cvWork.notify_all();
+
+    for (auto& worker : _vWorkers)
+        worker.join();
+}
+
+size_t ThreadPool::getThreadIndex() const
+{
+    return (tPool == this) ? tIndex : _vWorkers.size();
+}
+
+bool ThreadPool::push(const Task& task)
+{
+    return push(*_vQueues[getThreadIndex()], task);
+}
+
+bool ThreadPool::pushBackground(const Task& task)
+{
+    return push(_background, task);
+}
+
+bool ThreadPool::push(Queue& queue, const Task& task)
+{
+    // counted before the task is visible, a thief taking it at once must not
+    // bring _queued below 0. A worker going to sleep counts itself before it
+    // checks _queued, so one of the two sees the other (both sequentially consistent).
+    _queued.fetch_add(1);
+    if (!queue.push(task))
+    {
+        _queued.fetch_sub(1);
+        return false;
+    }
+
+    if (_sleeping.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cvWork.notify_one();
+    }
+    return true;
+}
+
+bool ThreadPool::runOne()
+{
+    size_t index = getThreadIndex();
+    size_t nQueues = _vQueues.size();
+
+    Task task;
+    bool bFound = _vQueues[index]->popBack(task);
+    for (size_t i = 1; i < nQueues && !bFound; i++)
+        bFound = _vQueues[(index + i) % nQueues]->popFront(task);
+    if (!bFound) return false;
+
+    _queued.fetch_sub(1);
+    TaskGroup::run(task);
+    return true;
+}
+
+bool ThreadPool::runBackground()
+{
+    Task task;
+    if (!_background.popFront(task)) return false;
+
+    _queued.fetch_sub(1);
+    TaskGroup::run(task);
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+    tPool = this;
+    tIndex = index;
+
+    while (true)
+    {
+        if (runOne() || runBackground()) continue;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping.fetch_add(1);
+        _cvWork.wait(lock, [this]() { return _bStop || _queued.load() > 0; });
+        _sleeping.fetch_sub(1);
+        if (_bStop) return;
+    }
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& fn)
+{
+    if (n == 0) return;
+
+    // not worth waking the workers
+    if (_vWorkers.empty() || n == 1)
+    {
+        for (size_t i = 0; i < n; i++) fn(i);
+        return;
+    }
+
+    // a loop per worker and one on this thread, taking the indices one by one
+    std::atomic<size_t> next{0};
+    auto loop = [&fn, &next, n]()
+    {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < n)
+            fn(i);
+    };
+
+    TaskGroup group(*this);
+    for (size_t t = 0; t < std::min(n - 1, _vWorkers.size()); t++)
+        group.spawn(loop);
+    loop();
+    group.sync();
+}
+
+void TaskGroup::sync()
+{
+    while (_pending.load(std::memory_order_acquire) > 0)
+    {
+        // a background group runs its own task first if no worker took it yet
+        bool bRan = _bBackground ? (_pool.runBackground() || _pool.runOne()) : _pool.runOne();
+        if (!bRan)
+            std::this_thread::yield();
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class TaskGroup;
+
+
+// a unit of work of the pool. The closure is stored inline, so a spawn does
+// not allocate and a task fits one cache line.
+struct Task
+{
+    static constexpr size_t STORAGE = 48;
+
+    void (*run)(Task&) = nullptr;
+    TaskGroup* group = nullptr;
+    alignas(std::max_align_t) unsigned char storage[STORAGE];
+};
+
+
+// pool of worker threads with a queue of tasks per worker. A worker runs the
+// last task it spawned first (depth first, as the recursion would) and, when
+// its queue is empty, steals the oldest task of another queue (the largest
+// subtrees of a traversal). The threads outside the pool share one more queue.
+// The background tasks have a queue of their own, taken by the idle workers only.
+class ThreadPool
+{
+    public:
+        // by default one worker per core besides the calling thread
+        ThreadPool(int nWorkers = -1);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        inline size_t getWorkerCount() const { return _vWorkers.size(); };
+
+        // index of the calling thread in [0, getWorkerCount()], the threads
+        // outside the pool all get getWorkerCount()
+        size_t getThreadIndex() const;
+
+        // run fn(i) for every i in [0, n) and return when all are done.
+        // Indices are handed out one by one, so uneven work is balanced.
+        void parallelFor(size_t n, const std::function<void(size_t)>& fn);
+
+    private:
+        friend class TaskGroup;
+
+        // fixed ring of tasks, the owner pushes and pops at the back, the thieves take the front
+        struct Queue
+        {
+            static constexpr size_t CAPACITY = 1024;
+
+            std::mutex mutex;
+            std::vector<Task> vTasks = std::vector<Task>(CAPACITY);
+            size_t head = 0; // the tasks are [head, tail), modulo CAPACITY
+            size_t tail = 0;
+
+            bool push(const Task& task);
+            bool popBack(Task& task);
+            bool popFront(Task& task);
+        };
+
+        // queue the task for the calling thread, false if its queue is full
+        bool push(const Task& task);
+        bool pushBackground(const Task& task);
+        bool push(Queue& queue, const Task& task);
+        // run a task of the calling thread or a stolen one, false if there was none
+        bool runOne();
+        // run the oldest background task, false if there was none
+        bool runBackground();
+        void workerLoop(size_t index);
+
+        std::vector<std::thread> _vWorkers;
+        std::vector<std::unique_ptr<Queue>> _vQueues; // one per worker, then the one of the other threads
+        Queue _background; // never taken by a sync() of a foreground group
+
+        std::atomic<size_t> _queued{0}; // tasks in the queues
+        std::atomic<int> _sleeping{0};
+        std::mutex _mutex; // for the sleep of the workers
+        std::condition_variable _cvWork;
+        bool _bStop = false;
+};
+
+
+// fork/join of tasks: spawn() queues the tasks and sync() returns when they are
+// all done. Meanwhile the thread in sync() runs tasks itself (its own first, then
+// stolen ones), so a task can spawn and sync its own group, as in a recursive
+// traversal, without blocking a worker.
+// A background group runs its tasks on the idle workers, the thread in the sync()
+// of another group never picks them up: a task overlapping the frame is not run
+// inline by the next parallel loop. Only its own sync() runs one still queued.
+class TaskGroup
+{
+    public:
+        TaskGroup(ThreadPool& pool, bool bBackground = false) : _pool(pool), _bBackground(bBackground) {};
+        ~TaskGroup() { sync(); };
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        // fn() on a thread of the pool, or right now if the queue of the thread is full.
+        // The closure is copied into the task: it captures pointers, references and
+        // values, and what it refers to must live until sync().
+        template <class FUNC>
+        void spawn(const FUNC& fn)
+        {
+            static_assert(sizeof(FUNC) <= Task::STORAGE, "closure too large for a task");
+            static_assert(std::is_trivially_copyable<FUNC>::value, "closure must be trivially copyable");
+
+            Task task;
+            task.run = [](Task& t) { (*reinterpret_cast<FUNC*>(t.storage))(); };
+            task.group = this;
+            new (task.storage) FUNC(fn);
+
+            _pending.fetch_add(1, std::memory_order_relaxed);
+            if (!(_bBackground ? _pool.pushBackground(task) : _pool.push(task)))
+                run(task);
+        }
+
+        // wait for the tasks spawned, running queued tasks meanwhile
+        void sync();
+
+    private:
+        friend class ThreadPool;
+
+        static void run(Task& task)
+        {
+            task.run(task);
+            task.group->_pending.fetch_sub(1, std::memory_order_release);
+        }
+
+        ThreadPool& _pool;
+        bool _bBackground;
+        std::atomic<size_t> _pending{0}; // spawned and not done
+};
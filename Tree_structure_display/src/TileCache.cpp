@@ -0,0 +1,137 @@
+#include "TileCache.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const size_t MAX_SPARE = 16; // surfaces kept for reuse, the others are freed
+}
+
+// destructor
+TileCache::~TileCache()
+{
+    clear();
+    for (auto* surface : _vSpare)
+        SDL_FreeSurface(surface);
+}
+
+int TileCache::levelForScale(float scale)
+{
+    int level = (int)floorf(-log2f(scale));
+    return std::clamp(level, MIN_LEVEL, MAX_LEVEL);
+}
+
+float TileCache::tileWorldSize(int level)
+{
+    return ldexpf((float)TILE_SIZE, level);
+}
+
+SDL_Surface* TileCache::find(const Key& key)
+{
+    auto it = _mTiles.find(hashKey(key));
+    if (it == _mTiles.end())
+    {
+        _stats.misses++;
+        return nullptr;
+    }
+
+    // move to the front of the lru list
+    _lTiles.splice(_lTiles.begin(), _lTiles, it->second);
+    _stats.hits++;
+    return it->second->surface;
+}
+
+void TileCache::insert(const Key& key, SDL_Surface* surface)
+{
+    uint64_t hash = hashKey(key);
+    auto it = _mTiles.find(hash);
+    if (it != _mTiles.end())
+        drop(it->second);
+
+    _lTiles.push_front({key, surface});
+    _mTiles[hash] = _lTiles.begin();
+    _stats.tiles++;
+    _stats.bytes += surfaceBytes(surface);
+
+    evict();
+}
+
+SDL_Surface* TileCache::takeSpare()
+{
+    if (_vSpare.empty()) return nullptr;
+
+    SDL_Surface* surface = _vSpare.back();
+    _vSpare.pop_back();
+    return surface;
+}
+
+void TileCache::invalidate(float x0, float y0, float x1, float y1)
+{
+    // the cache holds a few hundred tiles, cheaper than walking the tile ranges of every level
+    for (auto it = _lTiles.begin(); it != _lTiles.end();)
+    {
+        float size = tileWorldSize(it->key.level);
+        float tx0 = it->key.tx * size;
+        float ty0 = it->key.ty * size;
+
+        auto next = std::next(it);
+        if (tx0 < x1 && x0 < tx0 + size && ty0 < y1 && y0 < ty0 + size)
+        {
+            drop(it);
+            _stats.invalidations++;
+        }
+        it = next;
+    }
+}
+
+void TileCache::clear()
+{
+    while (!_lTiles.empty())
+        drop(_lTiles.begin());
+}
+
+void TileCache::setBudget(size_t budgetBytes)
+{
+    _budgetBytes = budgetBytes;
+    evict();
+}
+
+uint64_t TileCache::hashKey(const Key& key)
+{
+    // 8 bits for the level, 28 bits for each tile position
+    const uint64_t mask = (1u << 28) - 1;
+    return ((uint64_t)(key.level - MIN_LEVEL) << 56) |
+           (((uint64_t)key.ty & mask) << 28) |
+           ((uint64_t)key.tx & mask);
+}
+
+size_t TileCache::surfaceBytes(const SDL_Surface* surface)
+{
+    return (size_t)surface->pitch * surface->h;
+}
+
+// remove a tile and keep its surface as a spare
+void TileCache::drop(std::list<Tile>::iterator it)
+{
+    _stats.tiles--;
+    _stats.bytes -= surfaceBytes(it->surface);
+
+    if (_vSpare.size() < MAX_SPARE)
+        _vSpare.push_back(it->surface);
+    else
+        SDL_FreeSurface(it->surface);
+
+    _mTiles.erase(hashKey(it->key));
+    _lTiles.erase(it);
+}
+
+// drop the least recently used tiles over the budget, the newest one is always kept
+void TileCache::evict()
+{
+    while (_stats.bytes > _budgetBytes && _lTiles.size() > 1)
+    {
+        drop(std::prev(_lTiles.end()));
+        _stats.evictions++;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "SDL2/SDL.h"
+
+
+// LRU cache of rasterised world tiles for static scenes. The tiles form a
+// mip pyramid: a tile of level L has TILE_SIZE x TILE_SIZE pixels and covers
+// TILE_SIZE * 2^L world units, so the level 0 is at 1 pixel per world unit,
+// the positive levels are zoomed out and the negative ones zoomed in.
+// The cache owns the tile surfaces, the least recently used ones are dropped
+// when the memory budget is exceeded.
+class TileCache
+{
+    public:
+        static constexpr int TILE_SIZE = 256;
+        static constexpr int MIN_LEVEL = -4; // 16 pixels per world unit
+        static constexpr int MAX_LEVEL = 20;
+
+        struct Key
+        {
+            int level;
+            int tx, ty; // tile position in the level
+        };
+
+        struct Stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0; // over the budget
+            uint64_t invalidations = 0; // tiles dropped by invalidate()
+            size_t tiles = 0;
+            size_t bytes = 0;
+        };
+
+        TileCache(size_t budgetBytes = 64u << 20) : _budgetBytes(budgetBytes) {};
+        ~TileCache();
+
+        TileCache(const TileCache&) = delete;
+        TileCache& operator=(const TileCache&) = delete;
+
+        // the level with at least the given pixels per world unit, so the
+        // tiles are only scaled down when drawn
+        static int levelForScale(float scale);
+        static float tileWorldSize(int level);
+
+        // the cached surface of the tile or nullptr, marked as recently used
+        SDL_Surface* find(const Key& key);
+
+        // add a tile, the cache takes the ownership of the surface
+        void insert(const Key& key, SDL_Surface* surface);
+
+        // a surface of a dropped tile to render a new one, or nullptr
+        SDL_Surface* takeSpare();
+
+        // drop the tiles of all levels overlapping the world rectangle [x0, x1) x [y0, y1)
+        void invalidate(float x0, float y0, float x1, float y1);
+        void clear();
+
+        void setBudget(size_t budgetBytes);
+        inline size_t getBudget() const { return _budgetBytes; };
+        inline const Stats& getStats() const { return _stats; };
+
+    private:
+        struct Tile
+        {
+            Key key;
+            SDL_Surface* surface;
+        };
+
+        static uint64_t hashKey(const Key& key);
+        static size_t surfaceBytes(const SDL_Surface* surface);
+        void drop(std::list<Tile>::iterator it);
+        void evict();
+
+        size_t _budgetBytes;
+        Stats _stats;
+        std::list<Tile> _lTiles; // the most recently used first
+        std::unordered_map<uint64_t, std::list<Tile>::iterator> _mTiles;
+        std::vector<SDL_Surface*> _vSpare; // surfaces of dropped tiles, reused
+};
@@ -0,0 +1,105 @@
+#include "TileRenderer.h"
+
+#include <algorithm>
+
+void TileRenderer::begin(int width, int height)
+{
+    _width = width;
+    _height = height;
+    _tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    _tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    // the bins keep their capacity, so a steady batch does not allocate
+    if (_vBins.size() < (size_t)(_tilesX * _tilesY))
+        _vBins.resize(_tilesX * _tilesY);
+    for (auto& bin : _vBins)
+        bin.clear();
+    _vPrimitives.clear();
+}
+
+void TileRenderer::addCircle(int cx, int cy, int r, uint32_t color, raster::Blend blend, uint8_t alpha)
+{
+    if (r < 0) return;
+    _vPrimitives.push_back({cx - r, cy - r, cx + r, cy + r, cx, cy, r, color, true, blend, alpha});
+    bin((uint32_t)_vPrimitives.size() - 1);
+}
+
+void TileRenderer::addRect(int x0, int y0, int x1, int y1, uint32_t color, raster::Blend blend, uint8_t alpha)
+{
+    _vPrimitives.push_back({x0, y0, x1, y1, 0, 0, 0, color, false, blend, alpha});
+    bin((uint32_t)_vPrimitives.size() - 1);
+}
+
+// add a primitive to all tiles overlapped by its bounds
+void TileRenderer::bin(uint32_t index)
+{
+    const Primitive& p = _vPrimitives[index];
+    int tx0 = std::max(0, p.x0) / TILE_SIZE;
+    int ty0 = std::max(0, p.y0) / TILE_SIZE;
+    int tx1 = std::min(_width - 1, p.x1);
+    int ty1 = std::min(_height - 1, p.y1);
+    if (tx1 < 0 || ty1 < 0 || p.x0 >= _width || p.y0 >= _height || p.x0 > p.x1 || p.y0 > p.y1)
+    {
+        _vPrimitives.pop_back(); // outside of the target
+        return;
+    }
+    tx1 /= TILE_SIZE;
+    ty1 /= TILE_SIZE;
+
+    for (int ty = ty0; ty <= ty1; ty++)
+    {
+        for (int tx = tx0; tx <= tx1; tx++)
+            _vBins[ty * _tilesX + tx].push_back(index);
+    }
+}
+
+void TileRenderer::flush(uint32_t* pixels, int pitch)
+{
+    if (!_vPrimitives.empty())
+    {
+        // only capture this, so the std::function does not allocate
+        _pTarget = pixels;
+        _targetPitch = pitch;
+        std::function<void(size_t)> job = [this](size_t tile) { rasterTile((int)tile, _pTarget, _targetPitch); };
+        _pool.parallelFor(_tilesX * _tilesY, job);
+    }
+
+    for (auto& bin : _vBins)
+        bin.clear();
+    _vPrimitives.clear();
+}
+
+// draw the primitives of a tile clipped to the tile
+void TileRenderer::rasterTile(int tile, uint32_t* pixels, int pitch) const
+{
+    const std::vector<uint32_t>& bin = _vBins[tile];
+    if (bin.empty()) return;
+
+    int tileX0 = (tile % _tilesX) * TILE_SIZE;
+    int tileY0 = (tile / _tilesX) * TILE_SIZE;
+    int tileX1 = std::min(_width, tileX0 + TILE_SIZE) - 1;
+    int tileY1 = std::min(_height, tileY0 + TILE_SIZE) - 1;
+
+    for (uint32_t index : bin)
+    {
+        const Primitive& p = _vPrimitives[index];
+        int y0 = std::max(tileY0, p.y0);
+        int y1 = std::min(tileY1, p.y1);
+
+        for (int y = y0; y <= y1; y++)
+        {
+            int x0 = p.x0;
+            int x1 = p.x1;
+            if (p.bCircle)
+            {
+                int hw = raster::circleHalfWidth(p.r, y - p.cy);
+                x0 = p.cx - hw;
+                x1 = p.cx + hw;
+            }
+            x0 = std::max(tileX0, x0);
+            x1 = std::min(tileX1, x1);
+            if (x0 <= x1)
+                raster::drawSpan(pixels + y * pitch, x0, x1, p.color, p.blend, p.alpha);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Raster.h"
+#include "ThreadPool.h"
+
+
+// batch of filled primitives rasterised by screen tiles. The primitives are
+// binned into the TILE_SIZE x TILE_SIZE tiles they overlap and the tiles are
+// rasterised in parallel, each one drawing all its primitives while its
+// pixels stay in the cache. Inside a tile, the primitives keep the order of
+// submission, so the result is the same as drawing them one by one.
+class TileRenderer
+{
+    public:
+        static constexpr int TILE_SIZE = 64;
+
+        TileRenderer(ThreadPool& pool) : _pool(pool) {};
+
+        // start a batch for a target of the given size
+        void begin(int width, int height);
+
+        // positions in pixels of the target, clipped at flush
+        void addCircle(int cx, int cy, int r, uint32_t color,
+                       raster::Blend blend = raster::Blend::COPY, uint8_t alpha = 255);
+        void addRect(int x0, int y0, int x1, int y1, uint32_t color,
+                     raster::Blend blend = raster::Blend::COPY, uint8_t alpha = 255);
+
+        // rasterise the batch into the target and clear it
+        void flush(uint32_t* pixels, int pitch);
+
+        inline size_t size() const { return _vPrimitives.size(); };
+
+    private:
+        struct Primitive
+        {
+            int x0, y0, x1, y1; // bounds, inclusive
+            int cx, cy, r; // circle only
+            uint32_t color;
+            bool bCircle;
+            raster::Blend blend;
+            uint8_t alpha;
+        };
+
+        void bin(uint32_t index);
+        void rasterTile(int tile, uint32_t* pixels, int pitch) const;
+
+        ThreadPool& _pool;
+        int _width = 0;
+        int _height = 0;
+        int _tilesX = 0;
+        int _tilesY = 0;
+        uint32_t* _pTarget = nullptr; // during flush
+        int _targetPitch = 0;
+        std::vector<Primitive> _vPrimitives;
+        std::vector<std::vector<uint32_t>> _vBins; // primitives of each tile, kept between batches
+};
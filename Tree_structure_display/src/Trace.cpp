@@ -0,0 +1,81 @@
+#include "Trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace
+{
+    namespace
+    {
+        const auto s_start = std::chrono::steady_clock::now();
+
+        // buffers are kept until the end of the program so the events of
+        // finished threads can still be exported
+        std::mutex s_mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> s_vBuffers;
+    }
+
+    ThreadBuffer& localBuffer()
+    {
+        thread_local ThreadBuffer* pBuffer = nullptr;
+        if (!pBuffer)
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+            s_vBuffers.push_back(std::make_unique<ThreadBuffer>((uint32_t)s_vBuffers.size()));
+            pBuffer = s_vBuffers.back().get();
+        }
+        return *pBuffer;
+    }
+
+    uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_start).count();
+    }
+
+    bool exportJson(const std::string& filename)
+    {
+        std::ofstream file(filename);
+        if (!file.good())
+        {
+            std::cout << "WARNING - cannot write trace to " << filename << std::endl;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(s_mutex);
+        size_t count = 0;
+        bool bFirst = true;
+
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        for (const auto& buffer : s_vBuffers)
+        {
+            file << (bFirst ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->tid()
+                 << ",\"args\":{\"name\":\"thread " << buffer->tid() << "\"}}";
+            bFirst = false;
+
+            // the owner thread may keep writing during the export, so we only
+            // read the events that cannot be overwritten before we copy them
+            size_t head = buffer->head();
+            size_t first = head > ThreadBuffer::CAPACITY / 2 ? head - ThreadBuffer::CAPACITY / 2 : 0;
+            for (size_t i = first; i < head; i++)
+            {
+                Event e = buffer->at(i);
+                file << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->tid()
+                     << ",\"ts\":" << e.start / 1000 << "." << (e.start % 1000) / 100
+                     << ",\"dur\":" << e.duration / 1000 << "." << (e.duration % 1000) / 100 << "}";
+                count++;
+            }
+        }
+        file << "\n]}" << std::endl;
+
+        std::cout << "DEBUG - " << count << " trace events written to " << filename << std::endl;
+        return true;
+    }
+}
+
+#endif
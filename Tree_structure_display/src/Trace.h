@@ -0,0 +1,91 @@
+#pragma once
+
+// Trace instrumentation exported as chrome trace-event json (chrome://tracing
+// or https://ui.perfetto.dev).
+//
+// The macros are compiled only when ENABLE_TRACE is defined (cmake -DENABLE_TRACE=ON),
+// otherwise they expand to nothing and cost nothing.
+//
+//  TRACE_SCOPE("name")       record a span until the end of the scope
+//  TRACE_FUNCTION()          record a span named after the enclosing function
+//  TRACE_EXPORT("file.json") write the recorded spans of all threads
+
+#ifdef ENABLE_TRACE
+
+#include <atomic>
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace trace
+{
+    struct Event
+    {
+        const char* name; // must be a string literal
+        uint64_t start; // ns since the start of the program
+        uint64_t duration; // ns
+    };
+
+    // ring buffer of the events of one thread. Only the owner thread writes,
+    // so the push is lock free; the oldest events are overwritten when full.
+    class ThreadBuffer
+    {
+        public:
+            static constexpr size_t CAPACITY = 1 << 16; // must be a power of 2
+
+            ThreadBuffer(uint32_t tid) : _tid(tid) {};
+
+            inline void push(const char* name, uint64_t start, uint64_t duration)
+            {
+                size_t head = _head.load(std::memory_order_relaxed);
+                _events[head & (CAPACITY - 1)] = {name, start, duration};
+                _head.store(head + 1, std::memory_order_release);
+            }
+
+            inline size_t head() const { return _head.load(std::memory_order_acquire); };
+            inline const Event& at(size_t i) const { return _events[i & (CAPACITY - 1)]; };
+            inline uint32_t tid() const { return _tid; };
+
+        private:
+            std::array<Event, CAPACITY> _events;
+            std::atomic<size_t> _head{0};
+            uint32_t _tid;
+    };
+
+    // buffer of the calling thread, created and registered on the first call
+    ThreadBuffer& localBuffer();
+
+    // ns since the start of the program
+    uint64_t now();
+
+    // write the events of all threads as chrome trace-event json
+    bool exportJson(const std::string& filename);
+
+    class Scope
+    {
+        public:
+            Scope(const char* name) : _name(name), _start(now()) {};
+            ~Scope() { localBuffer().push(_name, _start, now() - _start); };
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            const char* _name;
+            uint64_t _start;
+    };
+}
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(_traceScope, __LINE__)(name)
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
+#define TRACE_EXPORT(filename) trace::exportJson(filename)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_FUNCTION()
+#define TRACE_EXPORT(filename)
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+
+
+// lock-free hand-off of the latest value from one writer thread to one
+// reader thread. The writer fills the back buffer and publishes it, the
+// reader takes the latest published one. Neither ever waits, a value not
+// taken in time is replaced by the next one.
+template<class T>
+class TripleBuffer
+{
+    public:
+        // the buffer to fill, owned by the writer until publish()
+        inline T& back() { return _buffers[_back]; };
+
+        // swap the back buffer with the middle one
+        void publish()
+        {
+            _back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & INDEX;
+        };
+
+        // whether a value was published since the last take()
+        inline bool hasFresh() const { return _middle.load(std::memory_order_acquire) & FRESH; };
+
+        // the latest published value, or the previous one if nothing new
+        T& take()
+        {
+            if (hasFresh())
+                _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX;
+            return _buffers[_front];
+        };
+
+    private:
+        static constexpr int INDEX = 3;
+        static constexpr int FRESH = 4;
+
+        T _buffers[3];
+        int _back = 0; // writer only
+        int _front = 1; // reader only
+        std::atomic<int> _middle{2}; // index, with the FRESH bit when published and not taken
+};